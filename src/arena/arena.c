@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "arena.h"
+
+// scratch memory of one image : allocations only move a pointer forward and nothing is freed one by one,
+// the whole arena is reset before the next image. when a reset finds several blocks it replaces them by
+// a single block as big as all of them, so once the biggest image went through there is no malloc at all.
+
+struct ArenaBlock {
+    ArenaBlock* next;
+    size_t size;                // bytes of data
+    size_t used;
+    unsigned char* data;
+};
+
+static ArenaBlock* block_create(size_t size, ArenaBlock* next)
+{
+    ArenaBlock* block = malloc(sizeof(ArenaBlock));
+
+    if (!block || !(block -> data = malloc(size + ARENA_ALIGN)))
+    {
+        errx(EXIT_FAILURE, "arena: out of memory");
+    }
+
+    block -> next = next;
+    block -> size = size;
+    block -> used = 0;
+
+    return block;
+}
+
+static void blocks_free(ArenaBlock* block)
+{
+    while (block)
+    {
+        ArenaBlock* next = block -> next;
+
+        free(block -> data);
+        free(block);
+
+        block = next;
+    }
+}
+
+Arena* arena_create(size_t block_size)    // first block, the next ones are at least as big
+{
+    Arena* arena = calloc(1, sizeof(Arena));
+
+    if (!arena)
+    {
+        errx(EXIT_FAILURE, "arena: out of memory");
+    }
+
+    arena -> block = block_create(block_size, NULL);
+    arena -> capacity = arena -> block_size = block_size;
+
+    return arena;
+}
+
+static size_t padding(const ArenaBlock* block)    // bytes to the next aligned address of the block
+{
+    uintptr_t at = (uintptr_t)(block -> data + block -> used);
+
+    return (ARENA_ALIGN - (at & (ARENA_ALIGN - 1))) & (ARENA_ALIGN - 1);
+}
+
+void* arena_alloc(Arena* arena, size_t size)
+{
+    ArenaBlock* block = arena -> block;
+    size_t pad = padding(block);
+
+    if (block -> used + pad + size > block -> size)
+    {
+        size_t bytes = size > arena -> block_size ? size : arena -> block_size;
+
+        block = arena -> block = block_create(bytes, block);
+        arena -> capacity += bytes;
+        pad = padding(block);
+    }
+
+    void* p = block -> data + block -> used + pad;
+
+    block -> used += pad + size;
+    arena -> used += pad + size;
+
+    if (arena -> used > arena -> peak) arena -> peak = arena -> used;
+
+    arena -> last = p;
+
+    return p;
+}
+
+void* arena_calloc(Arena* arena, size_t count, size_t size)
+{
+    void* p = arena_alloc(arena, count * size);
+    memset(p, 0, count * size);
+
+    return p;
+}
+
+void* arena_grow(Arena* arena, void* p, size_t old_size, size_t new_size)     // realloc of the arena, in place for the last allocation
+{
+    ArenaBlock* block = arena -> block;
+
+    if (p && p == arena -> last && (unsigned char*)p + new_size <= block -> data + block -> size)
+    {
+        block -> used += new_size - old_size;
+        arena -> used += new_size - old_size;
+
+        if (arena -> used > arena -> peak) arena -> peak = arena -> used;
+
+        return p;
+    }
+
+    void* grown = arena_alloc(arena, new_size);
+
+    if (p)
+        memcpy(grown, p, old_size);
+
+    return grown;
+}
+
+void arena_reset(Arena* arena)    // everything allocated goes, the memory stays for the next image
+{
+    if (arena -> block -> next)     // several blocks : one block for all of them
+    {
+        blocks_free(arena -> block);
+        arena -> block = block_create(arena -> capacity, NULL);
+    }
+
+    arena -> block -> used = 0;
+    arena -> used = 0;
+    arena -> last = NULL;
+}
+
+void arena_free(Arena* arena)
+{
+    if (!arena)
+        return;
+
+    blocks_free(arena -> block);
+    free(arena);
+}
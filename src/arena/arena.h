@@ -0,0 +1,26 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_ALIGN 64          // every allocation starts on a cache line, fine for SIMD loads too
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock* block;          // block being filled, the older ones follow it
+    size_t used;                // bytes handed out since the last reset, padding included
+    size_t peak;                // most bytes ever in use between two resets
+    size_t capacity;            // bytes of all the blocks
+    size_t block_size;          // smallest block
+    void* last;                 // last allocation, the only one that can grow in place
+} Arena;
+
+Arena* arena_create(size_t block_size);
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_calloc(Arena* arena, size_t count, size_t size);
+void* arena_grow(Arena* arena, void* p, size_t old_size, size_t new_size);
+void arena_reset(Arena* arena);
+void arena_free(Arena* arena);
+
+#endif
@@ -0,0 +1,667 @@
+// libraries
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <SDL2/SDL.h>
+
+// headers
+#include "bench.h"
+#include "../loader/loader.h"
+#include "../pre_process/pre_process.h"
+#include "../rotate/rotate.h"
+#include "../parallel/parallel.h"
+#include "../components/components.h"
+#include "../normalize/normalize.h"
+#include "../gemm/gemm.h"
+
+#define BENCH_RUNS 5
+
+static double now_ms(void)
+{
+    return (double)SDL_GetPerformanceCounter() * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+// previous denoise, bubble sort of the 3x3 neighborhood on a full copy of the image
+// kept as the reference the median engine is checked and timed against
+static int reference_check_line(const uint8_t* pixels, int x, int y, int stride)
+{
+    if(pixels[y * stride + (x - 1)] != 255 && pixels[y * stride + (x + 1)] != 255) return 1;
+    if(pixels[(y - 1) * stride + x] != 255 && pixels[(y + 1) * stride + x] != 255) return 1;
+
+    return 0;
+}
+
+static void denoise_reference(GrayImage* image)
+{
+    int w = image -> w;
+    int h = image -> h;
+    int stride = image -> stride;
+
+    uint8_t* pixels = image -> pixels;
+    uint8_t* copy = malloc((size_t)stride * h);
+    memcpy(copy, pixels, (size_t)stride * h);
+
+    for (int y = 1; y < h - 1; y++)
+    {
+        for (int x = 1; x < w - 1; x++)
+        {
+            if(copy[y * stride + x] == 255) continue;
+            if(reference_check_line(copy, x, y, stride) == 1) continue;
+
+            uint8_t gray[9];
+            int k = 0;
+
+            for (int j = -1; j <= 1; j++)
+            {
+                for (int i = -1; i <= 1; i++)
+                {
+                    gray[k++] = copy[(y + j) * stride + (x + i)];
+                }
+            }
+
+            for (int m = 0; m < 8; m++)
+            {
+                for (int n = m + 1; n < 9; n++)
+                {
+                    if (gray[n] < gray[m])
+                    {
+                        uint8_t tmp = gray[m];
+                        gray[m] = gray[n];
+                        gray[n] = tmp;
+                    }
+                }
+            }
+
+            pixels[y * stride + x] = gray[4];
+        }
+    }
+
+    free(copy);
+}
+
+static int same_pixels(const GrayImage* a, const GrayImage* b)
+{
+    for (int y = 0; y < a -> h; y++)
+    {
+        if (memcmp(a -> pixels + (size_t)y * a -> stride, b -> pixels + (size_t)y * b -> stride, a -> w) != 0) return 0;
+    }
+
+    return 1;
+}
+
+static double time_denoise(const GrayImage* source, int size, GrayImage** out)  // best of BENCH_RUNS, on a fresh copy each time
+{
+    double best = -1.0;
+
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        GrayImage* image = gray_copy(source);
+
+        double start = now_ms();
+
+        if (size == 0)
+            denoise_reference(image);
+        else
+            denoise_kernel(image, size);
+
+        double elapsed = now_ms() - start;
+
+        if (best < 0.0 || elapsed < best) best = elapsed;
+
+        if (out && run == 0)
+            *out = image;
+        else
+            gray_free(image);
+    }
+
+    return best;
+}
+
+static void bench_denoise(char* file)
+{
+    SDL_Surface* surface = load_image(file);
+
+    int hist[256] = {0};
+    GrayImage* gray = to_gray_scale(surface, hist);
+    SDL_FreeSurface(surface);
+
+    GrayImage* expected = NULL;
+    GrayImage* result = NULL;
+
+    double reference = time_denoise(gray, 0, &expected);
+    double median3 = time_denoise(gray, 3, &result);
+    double median5 = time_denoise(gray, 5, NULL);
+    double median7 = time_denoise(gray, 7, NULL);
+
+    printf("%s (%dx%d) : reference %.2f ms, 3x3 %.2f ms (x%.1f, %s), 5x5 %.2f ms, 7x7 %.2f ms\n",
+           file, gray -> w, gray -> h, reference, median3, reference / median3,
+           same_pixels(expected, result) ? "identical" : "DIFFERENT", median5, median7);
+
+    gray_free(expected);
+    gray_free(result);
+    gray_free(gray);
+}
+
+static int same_bits(const BitImage* a, const BitImage* b)
+{
+    return a -> w == b -> w && a -> h == b -> h
+        && memcmp(a -> bits, b -> bits, (size_t)a -> words * a -> h * sizeof(uint64_t)) == 0;
+}
+
+static double time_preprocess(SDL_Surface* surface, int fused, BitImage** out)   // best of BENCH_RUNS, gray + denoise + binarize
+{
+    double best = -1.0;
+
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        int hist[256] = {0};
+
+        double start = now_ms();
+
+        BitImage* image = NULL;
+
+        if (fused)
+        {
+            image = preprocess_fused(surface, 3, hist);
+        }
+        else
+        {
+            GrayImage* gray = to_gray_scale(surface, hist);
+            denoise(gray);
+
+            image = binarize(gray, hist);
+            gray_free(gray);
+        }
+
+        double elapsed = now_ms() - start;
+
+        if (best < 0.0 || elapsed < best) best = elapsed;
+
+        if (out && run == 0)
+            *out = image;
+        else
+            bit_free(image);
+    }
+
+    return best;
+}
+
+static void bench_preprocess(char* file)
+{
+    SDL_Surface* surface = load_image(file);
+
+    BitImage* staged_image = NULL;
+    BitImage* fused_image = NULL;
+
+    double staged = time_preprocess(surface, 0, &staged_image);
+    double fused = time_preprocess(surface, 1, &fused_image);
+
+    printf("%s : staged %.2f ms, fused %.2f ms (x%.1f, %s)\n",
+           file, staged, fused, staged / fused, same_bits(staged_image, fused_image) ? "identical" : "DIFFERENT");
+
+    bit_free(staged_image);
+    bit_free(fused_image);
+    SDL_FreeSurface(surface);
+}
+
+static double time_binarize(const GrayImage* gray, int* hist, const char* method)   // best of BENCH_RUNS
+{
+    double best = -1.0;
+
+    binarize_set_method(method);
+
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        double start = now_ms();
+        BitImage* bits = binarize((GrayImage*)gray, hist);
+        double elapsed = now_ms() - start;
+
+        if (best < 0.0 || elapsed < best) best = elapsed;
+
+        bit_free(bits);
+    }
+
+    binarize_set_method("otsu");
+
+    return best;
+}
+
+static void bench_binarize(char* file)
+{
+    SDL_Surface* surface = load_image(file);
+
+    int hist[256] = {0};
+    GrayImage* gray = to_gray_scale(surface, hist);
+    SDL_FreeSurface(surface);
+
+    denoise(gray);
+
+    double otsu = time_binarize(gray, hist, "otsu");
+    double sauvola = time_binarize(gray, hist, "sauvola");
+    double niblack = time_binarize(gray, hist, "niblack");
+
+    printf("%s : otsu %.2f ms, sauvola %.2f ms, niblack %.2f ms\n", file, otsu, sauvola, niblack);
+
+    gray_free(gray);
+}
+
+// previous skew detection, linear sweep of every ink pixel into a fixed buffer,
+// 2 degrees steps over -30 .. 30 then 0.1 steps around the best one
+static double skew_sweep(const BitImage* image, double from, double to, double step)
+{
+    double best_angle = 0.0;
+    double best_score = -1.0;
+
+    for (double a = from; a <= to; a += step)
+    {
+        double s = sin(a * M_PI / 180.0);
+        double c = cos(a * M_PI / 180.0);
+
+        int proj[3000] = {0};
+
+        for (int y = 0; y < image -> h; y++)
+        {
+            for (int x = 0; x < image -> w; x++)
+            {
+                if (bit_get(image, x, y))
+                {
+                    int yr = (int)(x * s + y * c) + 1500;
+                    if ((unsigned)yr < 3000)
+                        proj[yr]++;
+                }
+            }
+        }
+
+        double score = 0.0;
+        for (int i = 0; i < 3000; i++)
+            score += (double)proj[i] * (double)proj[i];
+
+        if (score > best_score)
+        {
+            best_score = score;
+            best_angle = a;
+        }
+    }
+
+    return best_angle;
+}
+
+static double skew_reference(const BitImage* image)
+{
+    double coarse = skew_sweep(image, -30.0, 30.0, 2.0);
+
+    return skew_sweep(image, coarse - 2.0, coarse + 2.0, 0.1);
+}
+
+static void bench_skew(char* file)
+{
+    SDL_Surface* surface = load_image(file);
+
+    int hist[256] = {0};
+    BitImage* bits = preprocess_fused(surface, 3, hist);
+    SDL_FreeSurface(surface);
+
+    double best_reference = -1.0, best_engine = -1.0;
+    double reference_angle = 0.0, engine_angle = 0.0;
+
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        double start = now_ms();
+        reference_angle = skew_reference(bits);
+        double elapsed = now_ms() - start;
+
+        if (best_reference < 0.0 || elapsed < best_reference) best_reference = elapsed;
+
+        start = now_ms();
+        engine_angle = compute_skew_angle(bits);
+        elapsed = now_ms() - start;
+
+        if (best_engine < 0.0 || elapsed < best_engine) best_engine = elapsed;
+    }
+
+    printf("%s : reference %.2f ms (%.2f deg), engine %.2f ms (%.2f deg, x%.1f, %d threads)\n",
+           file, best_reference, reference_angle, best_engine, engine_angle, best_reference / best_engine, parallel_threads());
+
+    bit_free(bits);
+}
+
+// previous rotation, two doubles and a floor per destination pixel, in plain row order
+static BitImage* rotate_reference(const BitImage* image, double angle_deg)
+{
+    double a = angle_deg * M_PI / 180.0;
+    double s = sin(a), c = cos(a);
+
+    int sw = image -> w;
+    int sh = image -> h;
+
+    int dw = (int)ceil((fabs(sw * c) + fabs(sh * s)));
+    int dh = (int)ceil((fabs(sw * s) + fabs(sh * c)));
+
+    BitImage* rotated = bit_create(dw, dh);
+
+    double scx = (sw - 1) * 0.5;
+    double scy = (sh - 1) * 0.5;
+    double dcx = (dw - 1) * 0.5;
+    double dcy = (dh - 1) * 0.5;
+
+    for (int y = 0; y < dh; ++y)
+    {
+        double dy = y - dcy;
+
+        for (int x = 0; x < dw; ++x)
+        {
+            double dx = x - dcx;
+
+            int ix = (int)floor( c * dx + s * dy + scx + 0.5);
+            int iy = (int)floor(-s * dx + c * dy + scy + 0.5);
+
+            if ((unsigned)ix < (unsigned)sw && (unsigned)iy < (unsigned)sh && bit_get(image, ix, iy))
+                bit_set(rotated, x, y);
+        }
+    }
+
+    return rotated;
+}
+
+static long different_bits(const BitImage* a, const BitImage* b)
+{
+    long count = 0;
+
+    for (size_t i = 0; i < (size_t)a -> words * a -> h; i++)
+        count += __builtin_popcountll(a -> bits[i] ^ b -> bits[i]);
+
+    return count;
+}
+
+static double time_rotate(const BitImage* image, double angle, int reference, BitImage** out)   // best of BENCH_RUNS
+{
+    double best = -1.0;
+
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        double start = now_ms();
+        BitImage* rotated = reference ? rotate_reference(image, angle) : rotate_bits(image, angle);
+        double elapsed = now_ms() - start;
+
+        if (best < 0.0 || elapsed < best) best = elapsed;
+
+        if (out && run == 0)
+            *out = rotated;
+        else
+            bit_free(rotated);
+    }
+
+    return best;
+}
+
+static void bench_rotate(char* file)
+{
+    SDL_Surface* surface = load_image(file);
+
+    int hist[256] = {0};
+    BitImage* bits = preprocess_fused(surface, 3, hist);
+    SDL_FreeSurface(surface);
+
+    double angle = 7.3;     // any angle, the cost does not depend on it much
+    BitImage* expected = NULL;
+    BitImage* result = NULL;
+
+    double reference = time_rotate(bits, angle, 1, &expected);
+
+    rotate_set_mode("nearest");
+    double nearest = time_rotate(bits, angle, 0, &result);
+
+    rotate_set_mode("bilinear");
+    double bilinear = time_rotate(bits, angle, 0, NULL);
+
+    rotate_set_mode("nearest");
+
+    printf("%s : reference %.2f ms, nearest %.2f ms (x%.1f, %ld pixels differ), bilinear %.2f ms\n",
+           file, reference, nearest, reference / nearest, different_bits(expected, result), bilinear);
+
+    bit_free(expected);
+    bit_free(result);
+    bit_free(bits);
+}
+
+// previous glyph tiles, the letter box fitted in the tile by nearest sampling, no centre of mass
+static void normalize_reference(BitView view, uint8_t* tile)
+{
+    memset(tile, 0, GLYPH_PIXELS);
+
+    int size = view.w > view.h ? view.w : view.h;
+    int tw = view.w * GLYPH_FIT / size;
+    int th = view.h * GLYPH_FIT / size;
+
+    if (tw < 1) tw = 1;
+    if (th < 1) th = 1;
+
+    for (int ty = 0; ty < th; ty++)
+    {
+        uint8_t* out = tile + ((GLYPH_SIDE - th) / 2 + ty) * GLYPH_SIDE + (GLYPH_SIDE - tw) / 2;
+
+        for (int tx = 0; tx < tw; tx++)
+        {
+            int x = tx * view.w / tw;
+            out[tx] = ((bit_view_word(view, ty * view.h / th, x >> 6) >> (x & 63)) & 1) ? 255 : 0;
+        }
+    }
+}
+
+static void bench_normalize(char* file)
+{
+    SDL_Surface* surface = load_image(file);
+
+    int hist[256] = {0};
+    BitImage* bits = preprocess_fused(surface, 3, hist);
+    SDL_FreeSurface(surface);
+
+    Components* comps = components_label(bits);
+
+    int* letters = malloc((comps -> count ? comps -> count : 1) * sizeof(int));
+    int n = 0;
+
+    for (int i = 0; i < comps -> count; i++)    // the sizes segmentation keeps as letters
+    {
+        if (comps -> w[i] >= 2 && comps -> h[i] >= 13 && comps -> w[i] <= 60 && comps -> h[i] <= 60) letters[n++] = i;
+    }
+
+    GlyphBatch* batch = glyph_batch_create();
+    uint8_t tile[GLYPH_PIXELS];
+    float* scratch = malloc(GLYPH_SCRATCH(60) * sizeof(float));     // the widest letter kept
+
+    if (!scratch)
+    {
+        errx(EXIT_FAILURE, "bench: out of memory");
+    }
+
+    double best_reference = -1.0, best_area = -1.0;
+
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        double start = now_ms();
+
+        for (int k = 0; k < n; k++)
+        {
+            int i = letters[k];
+            normalize_reference(bit_view(bits, comps -> x[i], comps -> y[i], comps -> w[i], comps -> h[i]), tile);
+        }
+
+        double elapsed = now_ms() - start;
+
+        if (best_reference < 0.0 || elapsed < best_reference) best_reference = elapsed;
+
+        batch -> count = 0;
+        start = now_ms();
+
+        for (int k = 0; k < n; k++)
+        {
+            int i = letters[k];
+            BitView view = bit_view(bits, comps -> x[i], comps -> y[i], comps -> w[i], comps -> h[i]);
+
+            glyph_normalize(view, (float)component_cx(comps, i) - comps -> x[i], (float)component_cy(comps, i) - comps -> y[i], glyph_batch_add(batch, 0, k), scratch);
+        }
+
+        elapsed = now_ms() - start;
+
+        if (best_area < 0.0 || elapsed < best_area) best_area = elapsed;
+    }
+
+    printf("%s : %d glyphs, nearest fit %.2f ms, centred area averaging %.2f ms (%.0f glyphs/ms)\n",
+           file, n, best_reference, best_area, best_area > 0.0 ? n / best_area : 0.0);
+
+    glyph_batch_free(batch);
+    free(scratch);
+    free(letters);
+    components_free(comps);
+    bit_free(bits);
+}
+
+// previous dense layer loop, one dot product of a row of a and a row of b for every value of c = a b^T
+static void gemm_reference(int m, int n, int k, const float* a, const float* b, float* c)
+{
+    for (int i = 0; i < m; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            float z = 0.0f;
+
+            for (int p = 0; p < k; p++) z += a[(size_t)i * k + p] * b[(size_t)j * k + p];
+
+            c[(size_t)i * n + j] = z;
+        }
+    }
+}
+
+static double time_gemm(int m, int n, int k, const float* a, const float* b, float* c, float* pack, int reference)   // best of BENCH_RUNS
+{
+    double best = -1.0;
+
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        double start = now_ms();
+
+        if (reference) gemm_reference(m, n, k, a, b, c);
+        else gemm(0, 1, m, n, k, a, k, b, k, 0.0f, c, n, pack);
+
+        double elapsed = now_ms() - start;
+
+        if (best < 0.0 || elapsed < best) best = elapsed;
+    }
+
+    return best;
+}
+
+static void bench_gemm(int m, int n, int k)
+{
+    float* a = malloc((size_t)m * k * sizeof(float));
+    float* b = malloc((size_t)n * k * sizeof(float));
+    float* expected = malloc((size_t)m * n * sizeof(float));
+    float* c = malloc((size_t)m * n * sizeof(float));
+    float* pack = aligned_alloc(64, gemm_pack_floats() * sizeof(float));
+
+    if (!a || !b || !expected || !c || !pack)
+    {
+        errx(EXIT_FAILURE, "bench: out of memory");
+    }
+
+    for (size_t i = 0; i < (size_t)m * k; i++) a[i] = (float)((i * 7919) % 1000) / 1000.0f - 0.5f;
+    for (size_t i = 0; i < (size_t)n * k; i++) b[i] = (float)((i * 104729) % 1000) / 1000.0f - 0.5f;
+
+    double flop = 2.0 * m * n * k;
+    double reference = time_gemm(m, n, k, a, b, expected, pack, 1);
+
+    printf("%dx%dx%d : loop %.2f GFLOP/s", m, n, k, flop / (reference * 1e6));
+
+    GemmPath paths[3] = { GEMM_PORTABLE, GEMM_SSE2, GEMM_AVX2 };
+    const char* last = NULL;
+
+    for (int p = 0; p < 3; p++)
+    {
+        gemm_set_path(paths[p]);
+
+        if (last && strcmp(last, gemm_path_name()) == 0) continue;    // the cpu does not have it
+        last = gemm_path_name();
+
+        double ms = time_gemm(m, n, k, a, b, c, pack, 0);
+        float error = 0.0f;
+
+        for (size_t i = 0; i < (size_t)m * n; i++)
+        {
+            float d = fabsf(c[i] - expected[i]);
+            if (d > error) error = d;
+        }
+
+        printf(", %s %.2f GFLOP/s (x%.1f, error %.1e)", last, flop / (ms * 1e6), reference / ms, error);
+    }
+
+    printf("\n");
+
+    gemm_set_path(GEMM_AUTO);
+
+    free(a);
+    free(b);
+    free(expected);
+    free(c);
+    free(pack);
+}
+
+int run_bench(int argc, char *argv[])  // argv holds the images to run on
+{
+    if (argc < 1)
+    {
+        errx(EXIT_FAILURE, "bench needs at least one image");
+    }
+
+    printf("denoise, best of %d runs\n", BENCH_RUNS);
+
+    for (int i = 0; i < argc; i++)
+    {
+        bench_denoise(argv[i]);
+    }
+
+    printf("\ngray + denoise + binarize, best of %d runs\n", BENCH_RUNS);
+
+    for (int i = 0; i < argc; i++)
+    {
+        bench_preprocess(argv[i]);
+    }
+
+    printf("\nbinarization, best of %d runs\n", BENCH_RUNS);
+
+    for (int i = 0; i < argc; i++)
+    {
+        bench_binarize(argv[i]);
+    }
+
+    printf("\nskew detection, best of %d runs\n", BENCH_RUNS);
+
+    for (int i = 0; i < argc; i++)
+    {
+        bench_skew(argv[i]);
+    }
+
+    printf("\nrotation, best of %d runs\n", BENCH_RUNS);
+
+    for (int i = 0; i < argc; i++)
+    {
+        bench_rotate(argv[i]);
+    }
+
+    printf("\nglyph normalization, best of %d runs\n", BENCH_RUNS);
+
+    for (int i = 0; i < argc; i++)
+    {
+        bench_normalize(argv[i]);
+    }
+
+    printf("\nmatrix product m x n x k, best of %d runs, one thread\n", BENCH_RUNS);
+
+    bench_gemm(64, 256, 1024);     // first layer of the recognizer on a minibatch
+    bench_gemm(256, 256, 256);
+    bench_gemm(512, 512, 512);
+
+    return 0;
+}
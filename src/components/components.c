@@ -0,0 +1,277 @@
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include "components.h"
+
+// connected components (4 neighbors, like flood_fill) in two passes over runs of ink :
+// the first pass finds the runs of every row and unions the ones touching a run of the row above,
+// the second one gives every root a component number and gathers the statistics
+// (box, area, sums of x, y, x^2, y^2 and xy, each run adds closed forms so no pixel is read again),
+// the runs are then grouped by component so one component can be painted without a flood fill.
+
+typedef struct {
+    int y, x0, x1;      // run of ink from x0 to x1 included on row y
+    int parent;         // union-find link between runs
+} Run;
+
+static int find_root(Run* runs, int i)
+{
+    while (runs[i].parent != i)
+    {
+        runs[i].parent = runs[runs[i].parent].parent;  // path halving
+        i = runs[i].parent;
+    }
+
+    return i;
+}
+
+static void union_runs(Run* runs, int a, int b)
+{
+    a = find_root(runs, a);
+    b = find_root(runs, b);
+
+    if (a == b) return;
+
+    if (a < b) runs[b].parent = a;     // the earliest run stays the root
+    else runs[a].parent = b;
+}
+
+static int64_t squares_up_to(int64_t n)     // 0^2 + 1^2 + ... + n^2
+{
+    return n < 1 ? 0 : n * (n + 1) * (2 * n + 1) / 6;
+}
+
+static void* checked_malloc(size_t size)
+{
+    void* p = malloc(size ? size : 1);
+
+    if (!p)
+    {
+        errx(EXIT_FAILURE, "components_label: out of memory");
+    }
+
+    return p;
+}
+
+Components* components_label(const BitImage* image)
+{
+    int capacity = 1024;
+    int n_runs = 0;
+
+    Run* runs = checked_malloc(capacity * sizeof(Run));
+
+    int prev_start = 0, prev_end = 0;   // runs of the row above
+
+    for (int y = 0; y < image -> h; y++)
+    {
+        const uint64_t* row = bit_row(image, y);
+
+        int row_start = n_runs;
+        int p = prev_start;             // first run above that may still touch
+
+        int x = bit_next_ink(row, image -> words, 0);
+
+        while (x >= 0)
+        {
+            int end = bit_next_white(row, x) - 1;
+
+            if (n_runs >= capacity)
+            {
+                capacity *= 2;
+                runs = realloc(runs, capacity * sizeof(Run));
+
+                if (!runs)
+                {
+                    errx(EXIT_FAILURE, "components_label: out of memory");
+                }
+            }
+
+            runs[n_runs] = (Run){ y, x, end, n_runs };
+
+            while (p < prev_end && runs[p].x1 < x) p++;     // runs above ending before this one never touch again
+
+            for (int q = p; q < prev_end && runs[q].x0 <= end; q++)
+            {
+                union_runs(runs, n_runs, q);
+            }
+
+            n_runs++;
+
+            x = (end + 1 < image -> w) ? bit_next_ink(row, image -> words, end + 1) : -1;
+        }
+
+        prev_start = row_start;
+        prev_end = n_runs;
+    }
+
+    int* label = checked_malloc(n_runs * sizeof(int));
+    int count = 0;
+
+    for (int i = 0; i < n_runs; i++)    // runs are in raster order, so components are numbered by their first pixel
+    {
+        int root = find_root(runs, i);
+        label[i] = (root == i) ? count++ : label[root];
+    }
+
+    Components* c = checked_malloc(sizeof(Components));
+
+    c -> count = count;
+    c -> x = checked_malloc(count * sizeof(int));
+    c -> y = checked_malloc(count * sizeof(int));
+    c -> w = checked_malloc(count * sizeof(int));
+    c -> h = checked_malloc(count * sizeof(int));
+    c -> area = calloc(count ? count : 1, sizeof(int));
+    c -> sum_x = calloc(count ? count : 1, sizeof(int64_t));
+    c -> sum_y = calloc(count ? count : 1, sizeof(int64_t));
+    c -> sum_xx = calloc(count ? count : 1, sizeof(int64_t));
+    c -> sum_yy = calloc(count ? count : 1, sizeof(int64_t));
+    c -> sum_xy = calloc(count ? count : 1, sizeof(int64_t));
+
+    if (!c -> area || !c -> sum_x || !c -> sum_y || !c -> sum_xx || !c -> sum_yy || !c -> sum_xy)
+    {
+        errx(EXIT_FAILURE, "components_label: out of memory");
+    }
+
+    for (int i = 0; i < count; i++)     // x and y hold the max corner until the end
+    {
+        c -> x[i] = image -> w;
+        c -> y[i] = image -> h;
+        c -> w[i] = -1;
+        c -> h[i] = -1;
+    }
+
+    for (int i = 0; i < n_runs; i++)
+    {
+        int l = label[i];
+        int len = runs[i].x1 - runs[i].x0 + 1;
+
+        if (runs[i].x0 < c -> x[l]) c -> x[l] = runs[i].x0;
+        if (runs[i].x1 > c -> w[l]) c -> w[l] = runs[i].x1;
+        if (runs[i].y < c -> y[l]) c -> y[l] = runs[i].y;
+        if (runs[i].y > c -> h[l]) c -> h[l] = runs[i].y;
+
+        int64_t y = runs[i].y;
+        int64_t sx = (int64_t)(runs[i].x0 + runs[i].x1) * len / 2;
+
+        c -> area[l] += len;
+        c -> sum_x[l] += sx;
+        c -> sum_y[l] += y * len;
+        c -> sum_xx[l] += squares_up_to(runs[i].x1) - squares_up_to(runs[i].x0 - 1);
+        c -> sum_yy[l] += y * y * len;
+        c -> sum_xy[l] += y * sx;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        c -> w[i] = c -> w[i] - c -> x[i] + 1;
+        c -> h[i] = c -> h[i] - c -> y[i] + 1;
+    }
+
+    c -> n_runs = n_runs;
+    c -> run_start = calloc(count + 1, sizeof(int));
+    c -> run_y = checked_malloc(n_runs * sizeof(int));
+    c -> run_x0 = checked_malloc(n_runs * sizeof(int));
+    c -> run_x1 = checked_malloc(n_runs * sizeof(int));
+
+    if (!c -> run_start)
+    {
+        errx(EXIT_FAILURE, "components_label: out of memory");
+    }
+
+    for (int i = 0; i < n_runs; i++)    // counting sort of the runs by component, raster order is kept inside one
+    {
+        c -> run_start[label[i] + 1]++;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        c -> run_start[i + 1] += c -> run_start[i];
+    }
+
+    int* next = label;      // reused : label[i] becomes the slot of run i
+
+    for (int i = 0; i < n_runs; i++)
+    {
+        next[i] = c -> run_start[label[i]]++;
+    }
+
+    for (int i = count; i > 0; i--)     // run_start was moved to the end of every component
+    {
+        c -> run_start[i] = c -> run_start[i - 1];
+    }
+
+    c -> run_start[0] = 0;
+
+    for (int i = 0; i < n_runs; i++)
+    {
+        c -> run_y[next[i]] = runs[i].y;
+        c -> run_x0[next[i]] = runs[i].x0;
+        c -> run_x1[next[i]] = runs[i].x1;
+    }
+
+    free(label);
+    free(runs);
+
+    return c;
+}
+
+void components_free(Components* components)
+{
+    if (!components)
+        return;
+
+    free(components -> x);
+    free(components -> y);
+    free(components -> w);
+    free(components -> h);
+    free(components -> area);
+    free(components -> sum_x);
+    free(components -> sum_y);
+    free(components -> sum_xx);
+    free(components -> sum_yy);
+    free(components -> sum_xy);
+    free(components -> run_start);
+    free(components -> run_y);
+    free(components -> run_x0);
+    free(components -> run_x1);
+    free(components);
+}
+
+void components_paint(const Components* components, int i, BitImage* image)   // sets the pixels of component i
+{
+    for (int r = components -> run_start[i]; r < components -> run_start[i + 1]; r++)
+    {
+        uint64_t* row = bit_row(image, components -> run_y[r]);
+
+        int x0 = components -> run_x0[r];
+        int x1 = components -> run_x1[r] + 1;
+
+        for (int k = x0 >> 6; k <= (x1 - 1) >> 6; k++)
+        {
+            int from = (k == x0 >> 6) ? (x0 & 63) : 0;
+            int to = (k == (x1 - 1) >> 6) ? ((x1 - 1) & 63) + 1 : 64;
+
+            row[k] |= bit_span_mask(from, to);
+        }
+    }
+}
+
+void components_erase(const Components* components, int i, BitImage* image)   // clears the pixels of component i, and only them
+{
+    for (int r = components -> run_start[i]; r < components -> run_start[i + 1]; r++)
+    {
+        uint64_t* row = bit_row(image, components -> run_y[r]);
+
+        int x0 = components -> run_x0[r];
+        int x1 = components -> run_x1[r] + 1;
+
+        for (int k = x0 >> 6; k <= (x1 - 1) >> 6; k++)
+        {
+            int from = (k == x0 >> 6) ? (x0 & 63) : 0;
+            int to = (k == (x1 - 1) >> 6) ? ((x1 - 1) & 63) + 1 : 64;
+
+            row[k] &= ~bit_span_mask(from, to);
+        }
+    }
+}
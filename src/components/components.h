@@ -0,0 +1,54 @@
+#ifndef COMPONENTS_H
+#define COMPONENTS_H
+
+#include "../image/image.h"
+
+typedef struct {
+    int count;          // number of components, in the order of their first pixel (top to bottom, left to right)
+    int *x, *y;         // bounding box top-left corner
+    int *w, *h;         // bounding box size
+    int *area;          // number of ink pixels
+    int64_t *sum_x;     // sums of the pixel coordinates, centroid = sum / area
+    int64_t *sum_y;
+    int64_t *sum_xx;    // sums of the products of the coordinates, for the second order moments
+    int64_t *sum_yy;
+    int64_t *sum_xy;
+    int n_runs;         // runs of ink of all the components
+    int *run_start;     // runs of component i are run_start[i] .. run_start[i + 1] - 1, top to bottom
+    int *run_y, *run_x0, *run_x1;   // run from x0 to x1 included on row y
+} Components;
+
+Components* components_label(const BitImage* image);
+void components_free(Components* components);
+void components_paint(const Components* components, int i, BitImage* image);
+void components_erase(const Components* components, int i, BitImage* image);
+
+static inline double component_cx(const Components* c, int i)
+{
+    return (double)c -> sum_x[i] / c -> area[i];
+}
+
+static inline double component_cy(const Components* c, int i)
+{
+    return (double)c -> sum_y[i] / c -> area[i];
+}
+
+// second order central moments, divided by the area : spread of the ink around the centroid
+static inline double component_mu20(const Components* c, int i)
+{
+    double cx = component_cx(c, i);
+    return (double)c -> sum_xx[i] / c -> area[i] - cx * cx;
+}
+
+static inline double component_mu02(const Components* c, int i)
+{
+    double cy = component_cy(c, i);
+    return (double)c -> sum_yy[i] / c -> area[i] - cy * cy;
+}
+
+static inline double component_mu11(const Components* c, int i)
+{
+    return (double)c -> sum_xy[i] / c -> area[i] - component_cx(c, i) * component_cy(c, i);
+}
+
+#endif
@@ -0,0 +1,306 @@
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <SDL2/SDL.h>
+#include "corpus.h"
+
+// a packed corpus of glyphs : one file instead of a folder of small bitmaps per scan.
+// every glyph is a normalized tile (normalize.c), the tiles follow each other so the training side maps the file
+// and reads them in place. the index sits after the tiles : appending writes the new tiles over the old
+// index and writes the whole index again when the corpus is closed, the tiles themselves never move.
+
+struct CorpusWriter {
+    FILE* file;
+    char* path;
+    uint64_t count;
+    uint64_t capacity;
+    CorpusEntry* index;
+};
+
+_Static_assert(sizeof(CorpusHeader) == 64, "corpus header must stay 64 bytes");
+_Static_assert(sizeof(CorpusEntry) == 48, "corpus entry must stay 48 bytes");
+
+static void check_header(const CorpusHeader* header, uint64_t size, const char* path)
+{
+    if (memcmp(header -> magic, CORPUS_MAGIC, 8) != 0)
+        errx(EXIT_FAILURE, "corpus: %s is not a glyph corpus", path);
+
+    if (header -> version != CORPUS_VERSION || header -> tile != CORPUS_TILE)
+        errx(EXIT_FAILURE, "corpus: %s has version %u and %u pixel tiles, expected version %d and %d pixel tiles",
+             path, header -> version, header -> tile, CORPUS_VERSION, CORPUS_TILE);
+
+    if (header -> index_offset == 0)
+        errx(EXIT_FAILURE, "corpus: %s was not closed by the run writing it, its index is lost", path);
+
+    if (header -> count > size / CORPUS_TILE_BYTES || header -> tiles_offset > size || header -> index_offset > size     // no overflow below
+        || header -> tiles_offset + header -> count * CORPUS_TILE_BYTES > header -> index_offset
+        || header -> index_offset + header -> count * sizeof(CorpusEntry) > size)
+        errx(EXIT_FAILURE, "corpus: %s is truncated", path);
+}
+
+// index_offset 0 marks a corpus being written : the new tiles go over the old index, a run that stops before
+// corpus_close leaves a file that is refused instead of one whose index is made of tile bytes
+static void write_header(CorpusWriter* writer, uint64_t index_offset)
+{
+    CorpusHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CORPUS_MAGIC, 8);
+    header.version = CORPUS_VERSION;
+    header.tile = CORPUS_TILE;
+    header.count = writer -> count;
+    header.tiles_offset = sizeof(CorpusHeader);
+    header.index_offset = index_offset;
+
+    if (fseek(writer -> file, 0, SEEK_SET) != 0
+        || fwrite(&header, sizeof(header), 1, writer -> file) != 1
+        || fflush(writer -> file) != 0)
+        err(EXIT_FAILURE, "corpus: %s", writer -> path);
+}
+
+CorpusWriter* corpus_open(const char* path)     // appends to the corpus, creates it when it does not exist
+{
+    CorpusWriter* writer = calloc(1, sizeof(CorpusWriter));
+
+    if (!writer || !(writer -> path = strdup(path)))
+    {
+        errx(EXIT_FAILURE, "corpus: out of memory");
+    }
+
+    writer -> file = fopen(path, "r+b");
+
+    if (!writer -> file)
+    {
+        writer -> file = fopen(path, "w+b");
+
+        if (!writer -> file)
+            err(EXIT_FAILURE, "corpus: %s", path);
+
+        write_header(writer, 0);
+
+        return writer;
+    }
+
+    CorpusHeader header;
+    struct stat info;
+
+    if (fread(&header, sizeof(header), 1, writer -> file) != 1 || fstat(fileno(writer -> file), &info) != 0)
+        errx(EXIT_FAILURE, "corpus: %s is not a glyph corpus", path);
+
+    check_header(&header, (uint64_t)info.st_size, path);
+
+    writer -> count = writer -> capacity = header.count;
+    writer -> index = malloc((writer -> capacity ? writer -> capacity : 1) * sizeof(CorpusEntry));
+
+    if (!writer -> index)
+    {
+        errx(EXIT_FAILURE, "corpus: out of memory");
+    }
+
+    if (fseek(writer -> file, (long)header.index_offset, SEEK_SET) != 0
+        || fread(writer -> index, sizeof(CorpusEntry), writer -> count, writer -> file) != writer -> count)
+        err(EXIT_FAILURE, "corpus: %s", path);
+
+    if (header.tiles_offset != sizeof(CorpusHeader))     // tiles are moved nowhere, they must follow the header
+        errx(EXIT_FAILURE, "corpus: %s has tiles at %llu", path, (unsigned long long)header.tiles_offset);
+
+    write_header(writer, 0);     // before the first tile goes over the index
+
+    if (fseek(writer -> file, (long)(sizeof(CorpusHeader) + writer -> count * CORPUS_TILE_BYTES), SEEK_SET) != 0)
+        err(EXIT_FAILURE, "corpus: %s", path);
+
+    return writer;
+}
+
+void corpus_append(CorpusWriter* writer, const uint8_t* tile, int w, int h, const char* source, CorpusKind kind, int i, int j, int label)
+{
+    if (writer -> count == writer -> capacity)
+    {
+        writer -> capacity = writer -> capacity ? writer -> capacity * 2 : 1024;
+        writer -> index = realloc(writer -> index, writer -> capacity * sizeof(CorpusEntry));
+
+        if (!writer -> index)
+        {
+            errx(EXIT_FAILURE, "corpus: out of memory");
+        }
+    }
+
+    if (writer -> count == 0 && fseek(writer -> file, sizeof(CorpusHeader), SEEK_SET) != 0)
+        err(EXIT_FAILURE, "corpus: %s", writer -> path);
+
+    if (fwrite(tile, CORPUS_TILE_BYTES, 1, writer -> file) != 1)
+        err(EXIT_FAILURE, "corpus: %s", writer -> path);
+
+    CorpusEntry* entry = &writer -> index[writer -> count++];
+
+    memset(entry, 0, sizeof(CorpusEntry));
+    strncpy(entry -> source, source, CORPUS_SOURCE - 1);
+    entry -> kind = (uint8_t)kind;
+    entry -> label = (uint8_t)label;
+    entry -> w = (uint16_t)w;
+    entry -> h = (uint16_t)h;
+    entry -> i = (uint16_t)i;
+    entry -> j = (uint16_t)j;
+}
+
+uint64_t corpus_close(CorpusWriter* writer)    // writes the index and the header, returns the glyphs in the corpus
+{
+    if (!writer)
+        return 0;
+
+    uint64_t index_offset = sizeof(CorpusHeader) + writer -> count * CORPUS_TILE_BYTES;
+
+    if (fseek(writer -> file, (long)index_offset, SEEK_SET) != 0
+        || fwrite(writer -> index, sizeof(CorpusEntry), writer -> count, writer -> file) != writer -> count
+        || fflush(writer -> file) != 0)
+        err(EXIT_FAILURE, "corpus: %s", writer -> path);
+
+    write_header(writer, index_offset);     // the index is on disk, the corpus can be read again
+
+    if (fclose(writer -> file) != 0)
+        err(EXIT_FAILURE, "corpus: %s", writer -> path);
+
+    uint64_t count = writer -> count;
+
+    free(writer -> index);
+    free(writer -> path);
+    free(writer);
+
+    return count;
+}
+
+// labels file : the grid as for the solver, one row per line, then an empty line and the words of the list,
+// one per line, in the order they are on the scan. a glyph gets the letter at its place, 0 where there is none.
+CorpusLabels* corpus_labels_load(const char* path)
+{
+    FILE* file = fopen(path, "r");
+
+    if (!file)
+        err(EXIT_FAILURE, "corpus: %s", path);
+
+    CorpusLabels* labels = calloc(1, sizeof(CorpusLabels));
+    int capacity = 0, words = 0;
+    char line[256];
+
+    if (!labels)
+    {
+        errx(EXIT_FAILURE, "corpus: out of memory");
+    }
+
+    while (fgets(line, sizeof(line), file))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (line[0] == '\0')      // the grid ends at the first empty line
+        {
+            words |= labels -> count > 0;
+            continue;
+        }
+
+        if (labels -> count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 32;
+            labels -> lines = realloc(labels -> lines, capacity * sizeof(char*));
+
+            if (!labels -> lines)
+            {
+                errx(EXIT_FAILURE, "corpus: out of memory");
+            }
+        }
+
+        for (char* c = line; *c; c++)
+        {
+            if (*c >= 'a' && *c <= 'z') *c -= 32;
+        }
+
+        if (!(labels -> lines[labels -> count] = strdup(line)))
+        {
+            errx(EXIT_FAILURE, "corpus: out of memory");
+        }
+
+        labels -> count++;
+
+        if (!words) labels -> rows = labels -> count;
+    }
+
+    fclose(file);
+
+    return labels;
+}
+
+int corpus_label(const CorpusLabels* labels, CorpusKind kind, int i, int j)     // 'A' .. 'Z', 0 when the file has no letter there
+{
+    int line = (kind == CORPUS_GRID) ? i : labels -> rows + i;
+    int end = (kind == CORPUS_GRID) ? labels -> rows : labels -> count;
+
+    if (i < 0 || line >= end || j < 0 || j >= (int)strlen(labels -> lines[line]))
+        return 0;
+
+    char c = labels -> lines[line][j];
+
+    return (c >= 'A' && c <= 'Z') ? c : 0;
+}
+
+void corpus_labels_free(CorpusLabels* labels)
+{
+    if (!labels)
+        return;
+
+    for (int k = 0; k < labels -> count; k++)
+    {
+        free(labels -> lines[k]);
+    }
+
+    free(labels -> lines);
+    free(labels);
+}
+
+Corpus* corpus_map(const char* path)     // the tiles and the index are read in place, nothing is copied
+{
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+
+    if (fd < 0 || fstat(fd, &info) != 0)
+        err(EXIT_FAILURE, "corpus: %s", path);
+
+    if ((size_t)info.st_size < sizeof(CorpusHeader))
+        errx(EXIT_FAILURE, "corpus: %s is not a glyph corpus", path);
+
+    void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+        err(EXIT_FAILURE, "corpus: %s", path);
+
+    const CorpusHeader* header = data;
+    check_header(header, (uint64_t)info.st_size, path);
+
+    Corpus* corpus = malloc(sizeof(Corpus));
+
+    if (!corpus)
+    {
+        errx(EXIT_FAILURE, "corpus: out of memory");
+    }
+
+    corpus -> data = data;
+    corpus -> size = (size_t)info.st_size;
+    corpus -> count = header -> count;
+    corpus -> tiles = (const uint8_t*)data + header -> tiles_offset;
+    corpus -> index = (const CorpusEntry*)((const uint8_t*)data + header -> index_offset);
+
+    return corpus;
+}
+
+void corpus_unmap(Corpus* corpus)
+{
+    if (!corpus)
+        return;
+
+    munmap(corpus -> data, corpus -> size);
+    free(corpus);
+}
@@ -0,0 +1,72 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stdint.h>
+#include "../normalize/normalize.h"
+
+#define CORPUS_MAGIC "OCRGLYPH"
+#define CORPUS_VERSION 1
+#define CORPUS_TILE GLYPH_SIDE       // tiles are normalized glyphs
+#define CORPUS_TILE_BYTES (CORPUS_TILE * CORPUS_TILE)
+#define CORPUS_SOURCE 32            // bytes of the source image name, zero padded
+
+typedef enum {
+    CORPUS_GRID,        // i, j are the row and column in the grid
+    CORPUS_WORD         // i, j are the word and the letter in the word
+} CorpusKind;
+
+// file layout, little endian : header | count tiles | count entries
+// the tiles start at 64 bytes so every tile is 64 bytes aligned in the mapping
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t tile;              // side of a tile in pixels
+    uint64_t count;             // glyphs
+    uint64_t tiles_offset;      // bytes from the start of the file
+    uint64_t index_offset;      // 0 while a run appends to the corpus
+    uint8_t reserved[24];
+} CorpusHeader;                 // 64 bytes
+
+typedef struct {
+    char source[CORPUS_SOURCE];     // image the glyph comes from, without folder nor extension
+    uint8_t kind;                   // CorpusKind
+    uint8_t label;                  // 'A' .. 'Z', 0 when unknown
+    uint16_t w, h;                  // size of the glyph before it was normalized
+    uint16_t i, j;
+    uint8_t reserved[6];
+} CorpusEntry;                      // 48 bytes
+
+typedef struct {
+    void* data;                     // the whole file, mapped read only
+    size_t size;
+    uint64_t count;
+    const uint8_t* tiles;           // count x CORPUS_TILE_BYTES
+    const CorpusEntry* index;       // count entries
+} Corpus;
+
+typedef struct CorpusWriter CorpusWriter;
+
+typedef struct {
+    char** lines;               // the grid rows, then the words, in capitals
+    int rows;                   // grid rows, the words are the lines after them
+    int count;
+} CorpusLabels;                 // letters of the glyphs of a scan, written by hand
+
+CorpusWriter* corpus_open(const char* path);
+void corpus_append(CorpusWriter* writer, const uint8_t* tile, int w, int h, const char* source, CorpusKind kind, int i, int j, int label);
+uint64_t corpus_close(CorpusWriter* writer);
+
+CorpusLabels* corpus_labels_load(const char* path);
+int corpus_label(const CorpusLabels* labels, CorpusKind kind, int i, int j);
+void corpus_labels_free(CorpusLabels* labels);
+
+Corpus* corpus_map(const char* path);
+void corpus_unmap(Corpus* corpus);
+
+static inline const uint8_t* corpus_tile(const Corpus* corpus, uint64_t k)
+{
+    return corpus -> tiles + k * CORPUS_TILE_BYTES;
+}
+
+#endif
@@ -9,8 +9,15 @@
 #include "../pre_process/pre_process.h"
 #include "../rotate/rotate.h"
 #include "../segmentation/segmentation.h"
+#include "../writer/writer.h"
 
-int event_handler(SDL_Renderer *renderer, SDL_Texture **texture, SDL_Surface **surface, int *steps, int *hist, char *file) 
+void refresh_display(SDL_Surface **surface, GrayImage *image, BitImage *bits)     // the window only shows a copy of the image being processed
+{
+	SDL_FreeSurface(*surface);
+	*surface = bits ? bit_to_surface(bits) : gray_to_surface(image);
+}
+
+int event_handler(SDL_Renderer *renderer, SDL_Texture **texture, SDL_Surface **surface, GrayImage **image, BitImage **bits, int *steps, int *hist, char *file) 
 {
 	SDL_Event event;
 
@@ -34,7 +41,8 @@ int event_handler(SDL_Renderer *renderer, SDL_Texture **texture, SDL_Surface **s
 
 				case 0:
 
-					to_gray_scale(*surface, hist);
+					*image = to_gray_scale(*surface, hist);
+					refresh_display(surface, *image, *bits);
 
 					printf("Grayscale Done\n");
 					fflush(stdout);
@@ -43,7 +51,8 @@ int event_handler(SDL_Renderer *renderer, SDL_Texture **texture, SDL_Surface **s
 
 				case 1:
 
-					denoise(*surface);
+					denoise(*image);
+					refresh_display(surface, *image, *bits);
 
 					printf("Denoise Done\n");
 					fflush(stdout);
@@ -52,7 +61,10 @@ int event_handler(SDL_Renderer *renderer, SDL_Texture **texture, SDL_Surface **s
 
 				case 2:
 
-					binarize(*surface, hist);
+					*bits = binarize(*image, hist);
+					gray_free(*image);
+					*image = NULL;
+					refresh_display(surface, *image, *bits);
 
 					printf("Binarize Done\n");
 					fflush(stdout);
@@ -60,25 +72,36 @@ int event_handler(SDL_Renderer *renderer, SDL_Texture **texture, SDL_Surface **s
 					break;
 
 				case 3:
+				{
+					BitImage *rotated = rotate(*bits, NULL);
+
+					if(rotated != *bits)
+					{
+						bit_free(*bits);
+						*bits = rotated;
+					}
 
-					*surface = rotate(*surface);
+					refresh_display(surface, *image, *bits);
 
 					printf("Rotate Done\n");
 					fflush(stdout);
 
 					break;
+				}
 
 				case 4:
-					
-					SDL_Surface *copy = SDL_ConvertSurfaceFormat(*surface, SDL_PIXELFORMAT_RGBA8888, 0);
+				{
+					BitImage *copy = bit_copy(*bits);
 
-					save_letters(copy, *surface, file);
-					SDL_FreeSurface(copy);
+					save_letters(copy, *surface, file, NULL);
+					bit_free(copy);
+					writer_wait();
 					
 					printf("Segmentation Done\n");
 					fflush(stdout);
 
 					break;
+				}
 
 				default:
 
@@ -89,6 +112,7 @@ int event_handler(SDL_Renderer *renderer, SDL_Texture **texture, SDL_Surface **s
 				}
 
 				SDL_Texture *updated = SDL_CreateTextureFromSurface(renderer, *surface);
+				SDL_DestroyTexture(*texture);
 				*texture = updated;
 
 				(*steps)++;
@@ -97,9 +121,31 @@ int event_handler(SDL_Renderer *renderer, SDL_Texture **texture, SDL_Surface **s
 			{
 				double angle = event.key.keysym.sym == SDLK_LEFT ? -5.0 : 5.0;
 
-				*surface = rotozoomSurface(*surface, angle);
+				if(*bits)      // once binarized the bits are the image being processed
+				{
+					BitImage *rotated = rotate_bits(*bits, angle);
+					bit_free(*bits);
+					*bits = rotated;
+
+					refresh_display(surface, *image, *bits);
+				}
+				else if(*image)     // once grayscaled the plane is
+				{
+					GrayImage *rotated = rotate_gray(*image, angle);
+					gray_free(*image);
+					*image = rotated;
+
+					refresh_display(surface, *image, *bits);
+				}
+				else
+				{
+					SDL_Surface *rotated = rotozoomSurface(*surface, angle);
+					SDL_FreeSurface(*surface);
+					*surface = rotated;
+				}
 
 				SDL_Texture *updated = SDL_CreateTextureFromSurface(renderer, *surface);
+				SDL_DestroyTexture(*texture);
 				*texture = updated;
 
 				printf("Manual %s rotation Done\n", angle == -5.0 ? "left" : "right");
@@ -114,4 +160,4 @@ int event_handler(SDL_Renderer *renderer, SDL_Texture **texture, SDL_Surface **s
 	}
 
 	return 1;
-}
\ No newline at end of file
+}
\ No newline at end of file
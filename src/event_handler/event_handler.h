@@ -1,6 +1,8 @@
 #ifndef EVENT_HANDLER_H
 #define EVENT_HANDLER_H
 
-int event_handler(SDL_Renderer *renderer, SDL_Texture **texture, SDL_Surface **surface, int *steps, int *hist_ptr, char* file);
+#include "../image/image.h"
 
-#endif
\ No newline at end of file
+int event_handler(SDL_Renderer *renderer, SDL_Texture **texture, SDL_Surface **surface, GrayImage **image_ptr, BitImage **bits_ptr, int *steps, int *hist_ptr, char* file);
+
+#endif
\ No newline at end of file
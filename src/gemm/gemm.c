@@ -0,0 +1,337 @@
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "gemm.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GEMM_SIMD 1
+#endif
+
+// single precision matrix product, row major : c = op(a) op(b) + beta c, op transposes or not.
+// the product is cut in blocks that stay in cache : a KC deep panel of op(b) (NC columns) in the last level,
+// a MC x KC block of op(a) in the second one. both are copied (packed) into slivers of MR rows and NR columns,
+// in the order the kernel reads them, so the transposes only change the packing and the kernel reads
+// both operands contiguously. the kernel keeps a MR x NR tile of c in registers over the whole depth.
+
+#define GEMM_MR 6
+#define GEMM_NR 16
+#define GEMM_KC 256
+#define GEMM_MC 72          // multiple of GEMM_MR
+#define GEMM_NC 1024        // multiple of GEMM_NR
+
+typedef void (*kernel_fn)(int kc, const float* a, const float* b, float* c, int ldc, int accumulate);
+
+static GemmPath forced_path = GEMM_AUTO;
+
+void gemm_set_path(GemmPath path)     // GEMM_AUTO unless the paths are compared
+{
+    forced_path = path;
+}
+
+static GemmPath best_path(void)
+{
+#ifdef GEMM_SIMD
+    if (SDL_HasAVX2() && __builtin_cpu_supports("fma")) return GEMM_AVX2;
+    if (SDL_HasSSE2()) return GEMM_SSE2;
+#endif
+    return GEMM_PORTABLE;
+}
+
+static GemmPath current_path(void)     // a forced path the cpu does not have falls back to the best one
+{
+    GemmPath best = best_path();
+
+    return (forced_path == GEMM_AUTO || forced_path > best) ? best : forced_path;
+}
+
+const char* gemm_path_name(void)
+{
+    switch (current_path())
+    {
+        case GEMM_AVX2: return "avx2";
+        case GEMM_SSE2: return "sse2";
+        default: return "portable";
+    }
+}
+
+size_t gemm_pack_floats(void)     // size of the pack buffer gemm takes, one per thread
+{
+    return (size_t)GEMM_MC * GEMM_KC + (size_t)GEMM_KC * GEMM_NC;
+}
+
+static void kernel_portable(int kc, const float* a, const float* b, float* c, int ldc, int accumulate)
+{
+    float tile[GEMM_MR][GEMM_NR] = {{0}};
+
+    for (int p = 0; p < kc; p++)
+    {
+        for (int i = 0; i < GEMM_MR; i++)
+        {
+            float ai = a[i];
+
+            for (int j = 0; j < GEMM_NR; j++) tile[i][j] += ai * b[j];
+        }
+
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+
+    for (int i = 0; i < GEMM_MR; i++)
+    {
+        float* ci = c + (size_t)i * ldc;
+
+        for (int j = 0; j < GEMM_NR; j++) ci[j] = accumulate ? ci[j] + tile[i][j] : tile[i][j];
+    }
+}
+
+#ifdef GEMM_SIMD
+
+__attribute__((target("sse2")))
+static void kernel_sse2(int kc, const float* a, const float* b, float* c, int ldc, int accumulate)     // two halves of 8 columns, 12 accumulators each
+{
+    for (int half = 0; half < GEMM_NR; half += 8)
+    {
+        __m128 t[GEMM_MR][2];
+
+        for (int i = 0; i < GEMM_MR; i++) t[i][0] = t[i][1] = _mm_setzero_ps();
+
+        const float* ap = a;
+        const float* bp = b + half;
+
+        for (int p = 0; p < kc; p++)
+        {
+            __m128 b0 = _mm_load_ps(bp);
+            __m128 b1 = _mm_load_ps(bp + 4);
+
+            for (int i = 0; i < GEMM_MR; i++)
+            {
+                __m128 ai = _mm_set1_ps(ap[i]);
+
+                t[i][0] = _mm_add_ps(t[i][0], _mm_mul_ps(ai, b0));
+                t[i][1] = _mm_add_ps(t[i][1], _mm_mul_ps(ai, b1));
+            }
+
+            ap += GEMM_MR;
+            bp += GEMM_NR;
+        }
+
+        for (int i = 0; i < GEMM_MR; i++)
+        {
+            float* ci = c + (size_t)i * ldc + half;
+
+            if (accumulate)
+            {
+                t[i][0] = _mm_add_ps(t[i][0], _mm_loadu_ps(ci));
+                t[i][1] = _mm_add_ps(t[i][1], _mm_loadu_ps(ci + 4));
+            }
+
+            _mm_storeu_ps(ci, t[i][0]);
+            _mm_storeu_ps(ci + 4, t[i][1]);
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void kernel_avx2(int kc, const float* a, const float* b, float* c, int ldc, int accumulate)     // 12 accumulators, 2 loads and 6 broadcasts a step
+{
+    __m256 t00 = _mm256_setzero_ps(), t01 = _mm256_setzero_ps();
+    __m256 t10 = _mm256_setzero_ps(), t11 = _mm256_setzero_ps();
+    __m256 t20 = _mm256_setzero_ps(), t21 = _mm256_setzero_ps();
+    __m256 t30 = _mm256_setzero_ps(), t31 = _mm256_setzero_ps();
+    __m256 t40 = _mm256_setzero_ps(), t41 = _mm256_setzero_ps();
+    __m256 t50 = _mm256_setzero_ps(), t51 = _mm256_setzero_ps();
+
+    for (int p = 0; p < kc; p++)
+    {
+        __m256 b0 = _mm256_load_ps(b);
+        __m256 b1 = _mm256_load_ps(b + 8);
+        __m256 ai;
+
+        ai = _mm256_broadcast_ss(a);     t00 = _mm256_fmadd_ps(ai, b0, t00); t01 = _mm256_fmadd_ps(ai, b1, t01);
+        ai = _mm256_broadcast_ss(a + 1); t10 = _mm256_fmadd_ps(ai, b0, t10); t11 = _mm256_fmadd_ps(ai, b1, t11);
+        ai = _mm256_broadcast_ss(a + 2); t20 = _mm256_fmadd_ps(ai, b0, t20); t21 = _mm256_fmadd_ps(ai, b1, t21);
+        ai = _mm256_broadcast_ss(a + 3); t30 = _mm256_fmadd_ps(ai, b0, t30); t31 = _mm256_fmadd_ps(ai, b1, t31);
+        ai = _mm256_broadcast_ss(a + 4); t40 = _mm256_fmadd_ps(ai, b0, t40); t41 = _mm256_fmadd_ps(ai, b1, t41);
+        ai = _mm256_broadcast_ss(a + 5); t50 = _mm256_fmadd_ps(ai, b0, t50); t51 = _mm256_fmadd_ps(ai, b1, t51);
+
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+
+    __m256 t[GEMM_MR][2] = { {t00, t01}, {t10, t11}, {t20, t21}, {t30, t31}, {t40, t41}, {t50, t51} };
+
+    for (int i = 0; i < GEMM_MR; i++)
+    {
+        float* ci = c + (size_t)i * ldc;
+
+        if (accumulate)
+        {
+            t[i][0] = _mm256_add_ps(t[i][0], _mm256_loadu_ps(ci));
+            t[i][1] = _mm256_add_ps(t[i][1], _mm256_loadu_ps(ci + 8));
+        }
+
+        _mm256_storeu_ps(ci, t[i][0]);
+        _mm256_storeu_ps(ci + 8, t[i][1]);
+    }
+}
+
+#endif
+
+static kernel_fn pick_kernel(void)
+{
+    switch (current_path())
+    {
+#ifdef GEMM_SIMD
+        case GEMM_AVX2: return kernel_avx2;
+        case GEMM_SSE2: return kernel_sse2;
+#endif
+        default: return kernel_portable;
+    }
+}
+
+// op(a) rows ic .. ic + mc, depth pc .. pc + kc, into slivers of GEMM_MR rows, missing rows are 0
+static void pack_a(int transa, const float* a, int lda, int ic, int pc, int mc, int kc, float* pa)
+{
+    for (int ir = 0; ir < mc; ir += GEMM_MR)
+    {
+        int rows = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+
+        for (int p = 0; p < kc; p++)
+        {
+            for (int i = 0; i < GEMM_MR; i++)
+            {
+                int row = ic + ir + i, depth = pc + p;
+
+                if (i >= rows) pa[i] = 0.0f;
+                else pa[i] = transa ? a[(size_t)depth * lda + row] : a[(size_t)row * lda + depth];
+            }
+
+            pa += GEMM_MR;
+        }
+    }
+}
+
+// op(b) depth pc .. pc + kc, columns jc .. jc + nc, into slivers of GEMM_NR columns, missing columns are 0
+static void pack_b(int transb, const float* b, int ldb, int pc, int jc, int kc, int nc, float* pb)
+{
+    for (int jr = 0; jr < nc; jr += GEMM_NR)
+    {
+        int cols = nc - jr < GEMM_NR ? nc - jr : GEMM_NR;
+
+        for (int p = 0; p < kc; p++)
+        {
+            int depth = pc + p;
+
+            if (transb)
+            {
+                for (int j = 0; j < cols; j++) pb[j] = b[(size_t)(jc + jr + j) * ldb + depth];
+            }
+            else
+            {
+                memcpy(pb, b + (size_t)depth * ldb + jc + jr, cols * sizeof(float));
+            }
+
+            for (int j = cols; j < GEMM_NR; j++) pb[j] = 0.0f;
+
+            pb += GEMM_NR;
+        }
+    }
+}
+
+// one MR x NR tile of c, the ones on the right and bottom edges go through a full tile first
+static void tile(kernel_fn kernel, int kc, const float* pa, const float* pb, float* c, int ldc, int rows, int cols, int accumulate)
+{
+    if (rows == GEMM_MR && cols == GEMM_NR)
+    {
+        kernel(kc, pa, pb, c, ldc, accumulate);
+        return;
+    }
+
+    float edge[GEMM_MR * GEMM_NR] __attribute__((aligned(64)));
+
+    kernel(kc, pa, pb, edge, GEMM_NR, 0);
+
+    for (int i = 0; i < rows; i++)
+    {
+        float* ci = c + (size_t)i * ldc;
+
+        for (int j = 0; j < cols; j++) ci[j] = accumulate ? ci[j] + edge[i * GEMM_NR + j] : edge[i * GEMM_NR + j];
+    }
+}
+
+// c (m x n) = op(a) (m x k) op(b) (k x n) + beta c, with c not read when beta is 0.
+// pack holds gemm_pack_floats() floats aligned on 64 bytes, or NULL to allocate them for this call.
+void gemm(int transa, int transb, int m, int n, int k, const float* a, int lda, const float* b, int ldb,
+          float beta, float* c, int ldc, float* pack)
+{
+    if (m <= 0 || n <= 0)
+        return;
+
+    if (beta != 1.0f && (beta != 0.0f || k <= 0))
+    {
+        for (int i = 0; i < m; i++)
+        {
+            float* ci = c + (size_t)i * ldc;
+
+            for (int j = 0; j < n; j++) ci[j] = (beta == 0.0f) ? 0.0f : beta * ci[j];
+        }
+
+        beta = 1.0f;
+    }
+
+    if (k <= 0)
+        return;
+
+    float* owned = NULL;
+
+    if (!pack)
+    {
+        pack = owned = aligned_alloc(64, gemm_pack_floats() * sizeof(float));
+
+        if (!owned)
+        {
+            errx(EXIT_FAILURE, "gemm: out of memory");
+        }
+    }
+
+    float* pa = pack;
+    float* pb = pack + (size_t)GEMM_MC * GEMM_KC;
+    kernel_fn kernel = pick_kernel();
+
+    for (int jc = 0; jc < n; jc += GEMM_NC)
+    {
+        int nc = n - jc < GEMM_NC ? n - jc : GEMM_NC;
+
+        for (int pc = 0; pc < k; pc += GEMM_KC)
+        {
+            int kc = k - pc < GEMM_KC ? k - pc : GEMM_KC;
+            int accumulate = pc > 0 || beta != 0.0f;
+
+            pack_b(transb, b, ldb, pc, jc, kc, nc, pb);
+
+            for (int ic = 0; ic < m; ic += GEMM_MC)
+            {
+                int mc = m - ic < GEMM_MC ? m - ic : GEMM_MC;
+
+                pack_a(transa, a, lda, ic, pc, mc, kc, pa);
+
+                for (int jr = 0; jr < nc; jr += GEMM_NR)
+                {
+                    int cols = nc - jr < GEMM_NR ? nc - jr : GEMM_NR;
+
+                    for (int ir = 0; ir < mc; ir += GEMM_MR)
+                    {
+                        int rows = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+
+                        tile(kernel, kc, pa + (size_t)ir * kc, pb + (size_t)jr * kc, c + (size_t)(ic + ir) * ldc + jc + jr, ldc, rows, cols, accumulate);
+                    }
+                }
+            }
+        }
+    }
+
+    free(owned);
+}
@@ -0,0 +1,20 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stddef.h>
+
+typedef enum {
+    GEMM_AUTO,          // the best one the cpu has
+    GEMM_PORTABLE,
+    GEMM_SSE2,
+    GEMM_AVX2           // avx2 and fma
+} GemmPath;
+
+void gemm_set_path(GemmPath path);
+const char* gemm_path_name(void);
+size_t gemm_pack_floats(void);
+
+void gemm(int transa, int transb, int m, int n, int k, const float* a, int lda, const float* b, int ldb,
+          float beta, float* c, int ldc, float* pack);
+
+#endif
@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include "image.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+GrayImage* gray_create(int w, int h)
+{
+    GrayImage* image = malloc(sizeof(GrayImage));
+
+    if(!image)
+    {
+        errx(EXIT_FAILURE, "gray_create: out of memory");
+    }
+
+    image -> w = w;
+    image -> h = h;
+    image -> stride = (w + 15) & ~15;   // keep every row 16 bytes aligned
+    image -> pixels = calloc((size_t)image -> stride * (h > 0 ? h : 1), 1);
+
+    if(!image -> pixels)
+    {
+        errx(EXIT_FAILURE, "gray_create: out of memory");
+    }
+
+    return image;
+}
+
+GrayImage* gray_copy(const GrayImage* image)
+{
+    GrayImage* copy = gray_create(image -> w, image -> h);
+    memcpy(copy -> pixels, image -> pixels, (size_t)image -> stride * image -> h);
+
+    return copy;
+}
+
+void gray_free(GrayImage* image)
+{
+    if(!image)
+        return;
+
+    free(image -> pixels);
+    free(image);
+}
+
+SDL_Surface* gray_to_surface(const GrayImage* image)    // only needed to display or save
+{
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, image -> w, image -> h, 32, SDL_PIXELFORMAT_RGBA8888);
+
+    if(!surface)
+    {
+        errx(EXIT_FAILURE, "%s", SDL_GetError());
+    }
+
+    Uint32 colors[256];
+
+    for(int v = 0; v < 256; v++)
+    {
+        colors[v] = SDL_MapRGB(surface -> format, v, v, v);
+    }
+
+    Uint32* pixels = (Uint32*)surface -> pixels;
+    int pitch = surface -> pitch / 4;
+
+    for(int y = 0; y < image -> h; y++)
+    {
+        const uint8_t* row = image -> pixels + (size_t)y * image -> stride;
+
+        for(int x = 0; x < image -> w; x++)
+        {
+            pixels[y * pitch + x] = colors[row[x]];
+        }
+    }
+
+    return surface;
+}
+
+BitImage* bit_create(int w, int h)
+{
+    BitImage* image = malloc(sizeof(BitImage));
+
+    if(!image)
+    {
+        errx(EXIT_FAILURE, "bit_create: out of memory");
+    }
+
+    image -> w = w;
+    image -> h = h;
+    image -> words = (w + 63) / 64 + 1;
+    image -> bits = calloc((size_t)image -> words * (h > 0 ? h : 1), sizeof(uint64_t));
+
+    if(!image -> bits)
+    {
+        errx(EXIT_FAILURE, "bit_create: out of memory");
+    }
+
+    return image;
+}
+
+BitImage* bit_copy(const BitImage* image)
+{
+    BitImage* copy = bit_create(image -> w, image -> h);
+    memcpy(copy -> bits, image -> bits, (size_t)image -> words * image -> h * sizeof(uint64_t));
+
+    return copy;
+}
+
+BitImage* bit_crop(const BitImage* image, int x, int y, int w, int h)   // parts outside of the image are ink, like SDL_BlitSurface into a new surface
+{
+    if(w < 0) w = 0;    // boxes grouped from badly ordered letters can come out inverted
+    if(h < 0) h = 0;
+
+    if(x >= 0 && y >= 0 && x + w <= image -> w && y + h <= image -> h)
+    {
+        return bit_view_copy(bit_view(image, x, y, w, h));
+    }
+
+    BitImage* cropped = bit_create(w, h);
+
+    for(int j = 0; j < h; j++)
+    {
+        for(int i = 0; i < w; i++)
+        {
+            int sx = x + i, sy = y + j;
+
+            if(sx < 0 || sy < 0 || sx >= image -> w || sy >= image -> h || bit_get(image, sx, sy))
+            {
+                bit_set(cropped, i, j);
+            }
+        }
+    }
+
+    return cropped;
+}
+
+void bit_free(BitImage* image)
+{
+    if(!image)
+        return;
+
+    free(image -> bits);
+    free(image);
+}
+
+void bit_threshold_row(const uint8_t* row, int w, int cut, uint64_t* out)    // pixels darker than cut are ink
+{
+    int x = 0;
+
+    if(cut <= 0 || cut > 255)     // everything white or everything ink
+    {
+        for(; x < w; x += 64)
+        {
+            out[x >> 6] = (cut <= 0) ? 0 : ((x + 64 <= w) ? ~(uint64_t)0 : bit_span_mask(0, w - x));
+        }
+
+        return;
+    }
+
+#ifdef __SSE2__
+    __m128i c = _mm_set1_epi8((char)cut);
+
+    for(; x + 64 <= w; x += 64)   // white where max(v, cut) == v
+    {
+        __m128i v0 = _mm_loadu_si128((const __m128i*)(row + x));
+        __m128i v1 = _mm_loadu_si128((const __m128i*)(row + x + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i*)(row + x + 32));
+        __m128i v3 = _mm_loadu_si128((const __m128i*)(row + x + 48));
+
+        uint64_t m0 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v0, c), v0));
+        uint64_t m1 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v1, c), v1));
+        uint64_t m2 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v2, c), v2));
+        uint64_t m3 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v3, c), v3));
+
+        out[x >> 6] = ~(m0 | (m1 << 16) | (m2 << 32) | (m3 << 48));
+    }
+#endif
+
+    for(; x < w; x += 64)
+    {
+        uint64_t word = 0;
+        int end = (x + 64 < w) ? 64 : w - x;
+
+        for(int i = 0; i < end; i++)
+        {
+            word |= (uint64_t)(row[x + i] < cut) << i;
+        }
+
+        out[x >> 6] = word;
+    }
+}
+
+void bit_pack_row(const uint8_t* row, int w, uint64_t* out)     // every pixel that is not white is ink
+{
+    bit_threshold_row(row, w, 255, out);
+}
+
+BitImage* bit_from_gray(const GrayImage* image)
+{
+    BitImage* packed = bit_create(image -> w, image -> h);
+
+    for(int y = 0; y < image -> h; y++)
+    {
+        bit_pack_row(image -> pixels + (size_t)y * image -> stride, image -> w, bit_row(packed, y));
+    }
+
+    return packed;
+}
+
+SDL_Surface* bit_to_surface(const BitImage* image)      // only needed to display or save
+{
+    return bit_view_to_surface(bit_view(image, 0, 0, image -> w, image -> h));
+}
+
+BitView bit_view(const BitImage* image, int x, int y, int w, int h)    // the rectangle must be inside the image
+{
+    BitView view = { bit_row(image, y) + (x >> 6), image -> words, x & 63, w, h };
+
+    return view;
+}
+
+BitImage* bit_view_copy(BitView view)    // owned bits, when the view has to outlive or differ from its parent
+{
+    BitImage* copy = bit_create(view.w, view.h);
+
+    for(int j = 0; j < view.h; j++)
+    {
+        uint64_t* dst = bit_row(copy, j);
+
+        for(int k = 0; k < (view.w + 63) / 64; k++)
+        {
+            dst[k] = bit_view_word(view, j, k);
+        }
+    }
+
+    return copy;
+}
+
+SDL_Surface* bit_view_to_surface(BitView view)
+{
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, view.w, view.h, 32, SDL_PIXELFORMAT_RGBA8888);
+
+    if(!surface)
+    {
+        errx(EXIT_FAILURE, "%s", SDL_GetError());
+    }
+
+    Uint32 black = SDL_MapRGB(surface -> format, 0, 0, 0);
+    Uint32 white = SDL_MapRGB(surface -> format, 255, 255, 255);
+
+    Uint32* pixels = (Uint32*)surface -> pixels;
+    int pitch = surface -> pitch / 4;
+
+    for(int y = 0; y < view.h; y++)
+    {
+        for(int k = 0; k < (view.w + 63) / 64; k++)
+        {
+            uint64_t word = bit_view_word(view, y, k);
+            int n = (view.w - k * 64 < 64) ? view.w - k * 64 : 64;
+
+            for(int i = 0; i < n; i++)
+            {
+                pixels[y * pitch + k * 64 + i] = ((word >> i) & 1) ? black : white;
+            }
+        }
+    }
+
+    return surface;
+}
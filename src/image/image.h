@@ -0,0 +1,109 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+
+typedef struct {
+    int w, h;           // size in pixels
+    int stride;         // bytes per row, rows are padded to 16 bytes
+    uint8_t* pixels;    // one byte per pixel, 0 = black, 255 = white
+} GrayImage;
+
+typedef struct {
+    int w, h;           // size in pixels
+    int words;          // 64 bit words per row, plus one spare word so reads can run past the end
+    uint64_t* bits;     // pixel x of a row is bit x % 64 of word x / 64, 1 = ink (black)
+} BitImage;
+
+typedef struct {
+    const uint64_t* bits;   // word of the parent holding the top-left pixel
+    int words;              // words per row of the parent
+    int shift;              // position of the left column in that word
+    int w, h;               // size in pixels
+} BitView;                  // rectangle of a bit image, read in place without a copy
+
+GrayImage* gray_create(int w, int h);
+GrayImage* gray_copy(const GrayImage* image);
+void gray_free(GrayImage* image);
+
+SDL_Surface* gray_to_surface(const GrayImage* image);
+
+BitImage* bit_create(int w, int h);
+BitImage* bit_copy(const BitImage* image);
+BitImage* bit_crop(const BitImage* image, int x, int y, int w, int h);
+void bit_free(BitImage* image);
+
+void bit_threshold_row(const uint8_t* row, int w, int cut, uint64_t* out);
+void bit_pack_row(const uint8_t* row, int w, uint64_t* out);
+BitImage* bit_from_gray(const GrayImage* image);
+SDL_Surface* bit_to_surface(const BitImage* image);
+
+BitView bit_view(const BitImage* image, int x, int y, int w, int h);
+BitImage* bit_view_copy(BitView view);
+SDL_Surface* bit_view_to_surface(BitView view);
+
+static inline uint64_t* bit_row(const BitImage* image, int y)
+{
+    return image -> bits + (size_t)y * image -> words;
+}
+
+static inline int bit_get(const BitImage* image, int x, int y)
+{
+    return (bit_row(image, y)[x >> 6] >> (x & 63)) & 1;
+}
+
+static inline void bit_set(BitImage* image, int x, int y)
+{
+    bit_row(image, y)[x >> 6] |= (uint64_t)1 << (x & 63);
+}
+
+static inline uint64_t bit_span_mask(int from, int to)   // bits from .. to - 1 of a word, 0 <= from < to <= 64
+{
+    uint64_t high = (to == 64) ? ~(uint64_t)0 : (((uint64_t)1 << to) - 1);
+    return high & ~(((uint64_t)1 << from) - 1);
+}
+
+static inline int bit_next_ink(const uint64_t* row, int words, int x)     // first ink pixel of the row at or after x, or -1
+{
+    int k = x >> 6;
+
+    if (k >= words) return -1;
+
+    uint64_t word = row[k] & (~(uint64_t)0 << (x & 63));
+
+    while (!word)
+    {
+        if (++k >= words) return -1;
+        word = row[k];
+    }
+
+    return k * 64 + __builtin_ctzll(word);
+}
+
+static inline int bit_next_white(const uint64_t* row, int x)   // first white pixel of the row at or after x
+{
+    int k = x >> 6;
+
+    uint64_t word = ~row[k] & (~(uint64_t)0 << (x & 63));
+
+    while (!word)
+    {
+        word = ~row[++k];    // the spare word at the end of every row is white
+    }
+
+    return k * 64 + __builtin_ctzll(word);
+}
+
+static inline uint64_t bit_view_word(BitView view, int y, int k)    // word k of row y, bits past w are 0
+{
+    const uint64_t* src = view.bits + (size_t)y * view.words + k;
+
+    uint64_t word = view.shift ? (src[0] >> view.shift) | (src[1] << (64 - view.shift)) : src[0];     // the spare word keeps src[1] readable
+
+    if ((k + 1) * 64 > view.w)
+        word &= (view.w & 63) ? bit_span_mask(0, view.w & 63) : 0;
+
+    return word;
+}
+
+#endif
@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <math.h>
+#include "layout.h"
+
+// rows and columns of glyphs from their centroids, in linear time :
+// the centroids are dropped in one pixel buckets (a projection of the glyphs on each axis),
+// walking the buckets in order starts a new row (or column) wherever the gap to the previous
+// occupied bucket is larger than the allowed gap. glyphs are then put in reading order with two
+// counting sorts, by column then by row, instead of a comparison sort.
+
+static void* checked_calloc(size_t count, size_t size)
+{
+    void* p = calloc(count ? count : 1, size);
+
+    if (!p)
+    {
+        errx(EXIT_FAILURE, "layout: out of memory");
+    }
+
+    return p;
+}
+
+static int cluster(const float* v, int n, float gap, int* out)     // cluster of every value, numbered in increasing order, returns the count
+{
+    if (n == 0) return 0;
+
+    float lo = v[0], hi = v[0];
+
+    for (int i = 1; i < n; i++)
+    {
+        if (v[i] < lo) lo = v[i];
+        if (v[i] > hi) hi = v[i];
+    }
+
+    int range = (int)floorf(hi - lo) + 1;
+    int* bucket = checked_calloc(range, sizeof(int));   // glyphs per bucket, then cluster of the bucket
+
+    for (int i = 0; i < n; i++)
+    {
+        bucket[(int)floorf(v[i] - lo)]++;
+    }
+
+    int count = 0;
+    int last = -1;      // previous occupied bucket
+
+    for (int b = 0; b < range; b++)
+    {
+        if (!bucket[b]) continue;
+
+        if (last >= 0 && b - last > gap) count++;
+
+        bucket[b] = count;
+        last = b;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        out[i] = bucket[(int)floorf(v[i] - lo)];
+    }
+
+    free(bucket);
+
+    return count + 1;
+}
+
+static void counting_sort(const int* key, int keys, const int* in, int* out, int n)    // stable
+{
+    int* start = checked_calloc(keys + 1, sizeof(int));
+
+    for (int i = 0; i < n; i++) start[key[in[i]] + 1]++;
+    for (int k = 0; k < keys; k++) start[k + 1] += start[k];
+    for (int i = 0; i < n; i++) out[start[key[in[i]]]++] = in[i];
+
+    free(start);
+}
+
+Layout* layout_build(const float* cx, const float* cy, int n, float row_gap, float col_gap)
+{
+    Layout* layout = checked_calloc(1, sizeof(Layout));
+
+    layout -> n = n;
+    layout -> row = checked_calloc(n, sizeof(int));
+    layout -> col = checked_calloc(n, sizeof(int));
+    layout -> order = checked_calloc(n, sizeof(int));
+
+    layout -> rows = cluster(cy, n, row_gap, layout -> row);
+    layout -> cols = cluster(cx, n, col_gap, layout -> col);
+
+    int* by_col = checked_calloc(n, sizeof(int));
+
+    for (int i = 0; i < n; i++) layout -> order[i] = i;
+
+    counting_sort(layout -> col, layout -> cols, layout -> order, by_col, n);
+    counting_sort(layout -> row, layout -> rows, by_col, layout -> order, n);
+
+    free(by_col);
+
+    return layout;
+}
+
+void layout_cells(Layout* layout)    // the rows x cols matrix, only for a grid : with one column per x it is quadratic
+{
+    size_t cells = (size_t)layout -> rows * layout -> cols;
+
+    free(layout -> cells);
+    layout -> cells = checked_calloc(cells, sizeof(int));
+
+    for (size_t c = 0; c < cells; c++) layout -> cells[c] = -1;
+
+    for (int i = 0; i < layout -> n; i++)
+    {
+        int* cell = &layout -> cells[(size_t)layout -> row[i] * layout -> cols + layout -> col[i]];
+
+        if (*cell < 0) *cell = i;
+    }
+}
+
+void layout_free(Layout* layout)
+{
+    if (!layout)
+        return;
+
+    free(layout -> row);
+    free(layout -> col);
+    free(layout -> cells);
+    free(layout -> order);
+    free(layout);
+}
+
+int layout_median(const int* values, int n)    // of non negative values, by counting
+{
+    if (n == 0) return 0;
+
+    int max = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (values[i] > max) max = values[i];
+    }
+
+    int* count = checked_calloc(max + 1, sizeof(int));
+
+    for (int i = 0; i < n; i++) count[values[i]]++;
+
+    int seen = 0;
+    int v = 0;
+
+    while (seen + count[v] <= n / 2)
+    {
+        seen += count[v++];
+    }
+
+    free(count);
+
+    return v;
+}
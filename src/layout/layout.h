@@ -0,0 +1,23 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+typedef struct {
+    int n;              // number of glyphs
+    int rows, cols;
+    int *row;           // row of every glyph, top to bottom
+    int *col;           // column of every glyph, left to right
+    int *cells;         // rows x cols, the glyph of every cell or -1, the first glyph when several share a cell, NULL until layout_cells
+    int *order;         // every glyph, row by row and left to right inside a row
+} Layout;
+
+Layout* layout_build(const float* cx, const float* cy, int n, float row_gap, float col_gap);
+void layout_cells(Layout* layout);
+void layout_free(Layout* layout);
+int layout_median(const int* values, int n);
+
+static inline int layout_cell(const Layout* layout, int row, int col)
+{
+    return layout -> cells[(size_t)row * layout -> cols + col];
+}
+
+#endif
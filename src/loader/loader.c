@@ -11,6 +11,31 @@
 #include "../rotate/rotate.h"
 #include "../segmentation/segmentation.h"
 
+SDL_Surface* load_image(char *file)
+{
+	if (IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG) == 0) 
+	{
+		errx(EXIT_FAILURE, "Failed to init image: %s", IMG_GetError());
+	}
+
+	SDL_Surface *image = IMG_Load(file);
+
+	if(!image) 
+	{
+		errx(EXIT_FAILURE, "Failed to load image: %s.\nPlease make sure the file exists and has a valid image extension.", SDL_GetError());
+	}
+
+	SDL_Surface *converted = SDL_ConvertSurfaceFormat(image, SDL_PIXELFORMAT_RGBA8888, 0);
+	SDL_FreeSurface(image);
+
+	if(!converted)
+	{
+		errx(EXIT_FAILURE, "%s", SDL_GetError());
+	}
+
+	return converted;
+}
+
 void initialize(SDL_Window **window, SDL_Renderer **renderer, SDL_Texture **texture, char *file, SDL_Surface **surface)
 {	
 	SDL_Init(SDL_INIT_VIDEO);
@@ -30,28 +55,7 @@ void initialize(SDL_Window **window, SDL_Renderer **renderer, SDL_Texture **text
 	if(file != NULL) 
 		{
 		
-		if (IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG) == 0) 
-		{
-
-            errx(EXIT_FAILURE, "Failed to init image: %s", IMG_GetError());
-        }
-
-		SDL_Surface *image = IMG_Load(file);
-
-		if(!image) 
-		{
-          	errx(EXIT_FAILURE, "Failed to load image: %s.\nPlease make sure the file exists and has a valid image extension.", SDL_GetError());
-        }
-
-		SDL_Surface *converted = SDL_ConvertSurfaceFormat(image, SDL_PIXELFORMAT_RGBA8888, 0);
-		SDL_FreeSurface(image);
-
-		if(!converted)
-        {
-            errx(EXIT_FAILURE, "%s", SDL_GetError());
-        }
-
-		*surface = converted;
+		*surface = load_image(file);
 
 		SDL_Texture *input = SDL_CreateTextureFromSurface(*renderer, *surface);
 
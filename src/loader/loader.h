@@ -1,6 +1,7 @@
 #ifndef LOADER_H
 #define LOADER_H
 
+SDL_Surface* load_image(char *file);
 void initialize(SDL_Window **window, SDL_Renderer **renderer, SDL_Texture **texture, char *file, SDL_Surface **surface);
 void terminate(SDL_Window *window, SDL_Renderer *renderer, SDL_Texture *texture);
 void save_bmp(SDL_Renderer *renderer);
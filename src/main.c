@@ -8,39 +8,72 @@
 // headers
 #include "loader/loader.h"
 #include "event_handler/event_handler.h"
+#include "pre_process/pre_process.h"
+#include "rotate/rotate.h"
+#include "segmentation/segmentation.h"
+#include "writer/writer.h"
+#include "corpus/corpus.h"
+#include "bench/bench.h"
 #include "neuronal_network/mlp.h"
+#include "neuronal_network/train.h"
 #include "solver/solver.h"
 
-int run_mlp()
+int run_mlp()     // xor, two inputs and one softmax output per answer
 {
-    double X[4][2] = { {0,0}, {0,1}, {1,0}, {1,1} };
-    double T[4] = { 1, 0, 0, 1 };
-    
-    MLP *mlp = mlp_create(2, 2);
-    double h[2];
-    double lr = 0.5;
+    float X[4][2] = { {0,0}, {0,1}, {1,0}, {1,1} };
+    int T[4] = { 1, 0, 0, 1 };
+
+    int sizes[3] = { 2, 8, 2 };
+    MLP *mlp = mlp_create(2, sizes, 1);
+    MLPWork *work = mlp_work_create(mlp, 4);
+    float lr = 0.5f;
 
     for (int epoch = 0; epoch < 10000; ++epoch)
     {
-        double loss = 0.0;
-        for (int n = 0; n < 4; ++n)
-        {
-            double y = mlp_forward(mlp, X[n], h);
-            double t = T[n];
+        mlp_forward(mlp, work, &X[0][0], 4);
+        float loss = mlp_backward(mlp, work, T, 4);
+        mlp_step(mlp, work -> grad, lr);
 
-            loss += -(t * log(y + 1e-8) + (1.0 - t) * log(1.0 - y + 1e-8));
-            mlp_backward(mlp, X[n], h, y, t, lr);
-        }
-        if (epoch % 1000 == 0) printf("Epoch=%d loss=%.4f\n", epoch, loss / 4.0);
+        if (epoch % 1000 == 0) printf("Epoch=%d loss=%.4f\n", epoch, loss);
     }
 
+    const float *p = mlp_forward(mlp, work, &X[0][0], 4);
+
     for (int i = 0; i < 4; ++i)
     {
-        double y = mlp_forward(mlp, X[i], h);
-        printf("A=%.0f B=%.0f -> y=%.3f (target=%.0f)\n", X[i][0], X[i][1], y, T[i]);
+        printf("A=%.0f B=%.0f -> y=%.3f (target=%d)\n", X[i][0], X[i][1], p[i * 2 + 1], T[i]);
+    }
+
+    mlp_work_free(work);
+    mlp_free(mlp);
+    return 0;
+}
+
+int run_train(const char *path, int argc, char *argv[])     // trains the letter recognizer on the labeled glyphs of a corpus
+{
+    TrainOptions options;
+    train_default_options(&options);
+
+    for (int i = 0; i < argc; i++)
+    {
+        if (!train_parse_option(&options, argv[i]))
+        {
+            errx(EXIT_FAILURE, "unknown train option %s", argv[i]);
+        }
+    }
+
+    Corpus *corpus = corpus_map(path);
+    MLP *mlp = train_corpus(corpus, &options);
+
+    if (options.save)
+    {
+        mlp_save(mlp, options.save);
+        printf("model saved to %s\n", options.save);
     }
 
     mlp_free(mlp);
+    corpus_unmap(corpus);
+
     return 0;
 }
 
@@ -95,9 +128,335 @@ int run_solver(const char *filename, char *word)
     return 0;
 }
 
+int run_corpus(const char *path)     // maps a packed corpus and sums up its index
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    Corpus *corpus = corpus_map(path);
+
+    uint64_t grid = 0, labeled = 0;
+
+    for (uint64_t k = 0; k < corpus -> count; k++)
+    {
+        grid += corpus -> index[k].kind == CORPUS_GRID;
+        labeled += corpus -> index[k].label != 0;
+    }
+
+    double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+    printf("{\"corpus\":\"%s\",\"glyphs\":%llu,\"grid\":%llu,\"word\":%llu,\"labeled\":%llu,\"tile\":%d,\"load_ms\":%.2f}\n",
+           path, (unsigned long long)corpus -> count, (unsigned long long)grid, (unsigned long long)(corpus -> count - grid),
+           (unsigned long long)labeled, CORPUS_TILE, ms);
+
+    corpus_unmap(corpus);
+
+    return 0;
+}
+
+int run_model(const char *path, const char *corpus_path)     // maps a model, checks it and tells its accuracy on a corpus
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    MLP *mlp = mlp_load(path, 0);
+    double load_us = (double)(SDL_GetPerformanceCounter() - start) * 1e6 / (double)SDL_GetPerformanceFrequency();
+
+    mlp_free(mlp);
+
+    start = SDL_GetPerformanceCounter();
+    mlp = mlp_load(path, 1);
+    double verify_us = (double)(SDL_GetPerformanceCounter() - start) * 1e6 / (double)SDL_GetPerformanceFrequency();
+
+    if (corpus_path && (mlp -> sizes[0] != GLYPH_PIXELS || mlp_classes(mlp) != MLP_CLASSES))
+    {
+        errx(EXIT_FAILURE, "%s does not read %dx%d glyphs into letters", path, GLYPH_SIDE, GLYPH_SIDE);
+    }
+
+    printf("{\"model\":\"%s\",\"layers\":[", path);
+
+    for (int l = 0; l <= mlp -> layers; l++)
+    {
+        printf(l ? ",%d" : "%d", mlp -> sizes[l]);
+    }
+
+    printf("],\"parameters\":%zu,\"load_us\":%.1f,\"verify_us\":%.1f", mlp -> count, load_us, verify_us);
+
+    if (corpus_path)
+    {
+        Corpus *corpus = corpus_map(corpus_path);
+        QMLP *quantized = train_quantize(mlp, corpus);
+
+        double float_ms, int8_ms;
+        float float_accuracy = train_evaluate(mlp, corpus, &float_ms);
+        float int8_accuracy = train_evaluate_quantized(quantized, corpus, &int8_ms);
+
+        printf(",\"accuracy\":%.2f,\"int8_accuracy\":%.2f,\"accuracy_delta\":%.2f", float_accuracy, int8_accuracy, int8_accuracy - float_accuracy);
+        printf(",\"float_ms\":%.2f,\"int8_ms\":%.2f,\"float_bytes\":%zu,\"int8_bytes\":%zu",
+               float_ms, int8_ms, mlp -> count * sizeof(float), qmlp_bytes(quantized));
+
+        qmlp_free(quantized);
+        corpus_unmap(corpus);
+    }
+
+    printf("}\n");
+
+    mlp_free(mlp);
+
+    return 0;
+}
+
+// the grid and the words the model read, every word is then searched in the grid. glyphs : the grid letters
+// first (row and column), then the letters of every word (word and letter), as the segmentation saved them
+static int solve_letters(const GlyphBatch *glyphs, const char *letters, int grid_letters)     // words found
+{
+    char grid[100][100];
+    int rows = 0, cols = 0;
+
+    memset(grid, '.', sizeof(grid));    // a cell without a letter never matches
+
+    for (int k = 0; k < grid_letters; k++)
+    {
+        int i = glyphs -> i[k], j = glyphs -> j[k];
+
+        if (i >= 100 || j >= 99) continue;      // bigger than the solver grid
+
+        grid[i][j] = letters[k];
+        rows = i + 1 > rows ? i + 1 : rows;
+        cols = j + 1 > cols ? j + 1 : cols;
+    }
+
+    printf("Recognized grid:\n");
+
+    for (int i = 0; i < rows; i++)
+    {
+        grid[i][cols] = '\0';
+        printf("%s\n", grid[i]);
+    }
+
+    int found = 0;
+
+    for (int k = grid_letters; k < glyphs -> count; )
+    {
+        char word[100];
+        int index = glyphs -> i[k], len = 0;
+
+        for (; k < glyphs -> count && glyphs -> i[k] == index; k++)
+        {
+            if (len < 99) word[len++] = letters[k];
+        }
+
+        word[len] = '\0';
+
+        Solution sol = solve(grid, word, rows, cols);
+
+        if (sol.startRow == -1)
+        {
+            printf("Word %d: %s not found\n", index + 1, word);
+        }
+        else
+        {
+            printf("Word %d: %s (%d,%d),(%d,%d)\n", index + 1, word, sol.startCol, sol.startRow, sol.endCol, sol.endRow);
+            found++;
+        }
+    }
+
+    return found;
+}
+
+int run_headless(char *file, int median, int staged, const char *corpus_path, const char *labels_path, const char *model_path)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    SDL_Surface *surface = load_image(file);
+
+    int hist[256] = {0};
+    double angle = 0.0;
+    SegmentationSummary summary = {0};
+
+    BitImage *image = NULL;
+
+    if (staged)
+    {
+        GrayImage *gray = to_gray_scale(surface, hist);
+        denoise_kernel(gray, median);
+
+        image = binarize(gray, hist);
+        gray_free(gray);
+    }
+    else
+    {
+        image = preprocess_fused(surface, median, hist);
+    }
+
+    SDL_FreeSurface(surface);
+
+    BitImage *rotated = rotate(image, &angle);
+
+    if (rotated != image)
+    {
+        bit_free(image);
+        image = rotated;
+    }
+
+    CorpusLabels *labels = labels_path ? corpus_labels_load(labels_path) : NULL;     // before the corpus, a bad file leaves it untouched
+    CorpusWriter *corpus = corpus_path ? corpus_open(corpus_path) : NULL;
+    segmentation_set_corpus(corpus);
+    segmentation_set_labels(labels);
+
+    MLP *mlp = model_path ? mlp_load(model_path, 0) : NULL;
+
+    if (mlp && (mlp -> sizes[0] != GLYPH_PIXELS || mlp_classes(mlp) != MLP_CLASSES))
+    {
+        errx(EXIT_FAILURE, "%s does not read %dx%d glyphs into letters", model_path, GLYPH_SIDE, GLYPH_SIDE);
+    }
+
+    GlyphBatch *glyphs = mlp ? glyph_batch_create() : NULL;     // the letters go to the model instead of the disk
+    segmentation_set_batch(glyphs);
+
+    save_letters(image, NULL, file, &summary);
+    bit_free(image);
+
+    segmentation_set_batch(NULL);
+    segmentation_set_labels(NULL);
+    segmentation_set_corpus(NULL);
+    corpus_labels_free(labels);
+    corpus_close(corpus);
+
+    int found = 0;
+
+    if (mlp)
+    {
+        char *letters = malloc(glyphs -> count + 1);
+
+        if (!letters)
+        {
+            errx(EXIT_FAILURE, "headless: out of memory");
+        }
+
+        train_recognize(mlp, glyphs, letters);
+        found = solve_letters(glyphs, letters, summary.grid_letters);
+
+        free(letters);
+    }
+
+    int write_errors = writer_wait();    // the letters are still being written
+    writer_stop();
+
+    double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+    printf("{\"file\":\"%s\",\"binarize\":\"%s\",\"skew\":%.2f,\"skew_method\":\"%s\",\"skew_ms\":%.2f,\"boxes\":%d,\"words\":%d,\"grid_letters\":%d,\"word_letters\":%d,\"write_errors\":%d,\"arena_peak_kb\":%zu,\"time_ms\":%.1f",
+           file, binarize_method_name(), angle, skew_method_name(), skew_last_ms(), summary.boxes, summary.words, summary.grid_letters, summary.word_letters,
+           write_errors, (summary.arena_peak + 1023) / 1024, ms);
+
+    if (mlp)
+    {
+        printf(",\"recognized\":%d,\"words_found\":%d", glyphs -> count, found);
+    }
+
+    printf("}\n");
+
+    glyph_batch_free(glyphs);
+    mlp_free(mlp);
+
+    return 0;
+}
 
 int main(int argc, char *argv[]) 
 {
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    {
+        return run_bench(argc - 2, argv + 2);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--headless") == 0)
+    {
+        if(argc < 3)
+        {
+            errx(EXIT_FAILURE, "headless mode needs an image to process");
+        }
+
+        int median = 3;
+        int staged = 0;
+        int window = 0;
+        int writers = 0;
+        const char *corpus = NULL;
+        const char *labels = NULL;
+        const char *model = NULL;
+
+        for (int i = 3; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--staged") == 0)
+            {
+                staged = 1;
+            }
+            else if (strncmp(argv[i], "--skew=", 7) == 0)
+            {
+                if (!skew_set_method(argv[i] + 7))
+                {
+                    errx(EXIT_FAILURE, "unknown skew method %s (projection or hough)", argv[i] + 7);
+                }
+            }
+            else if (strncmp(argv[i], "--binarize=", 11) == 0)
+            {
+                if (!binarize_set_method(argv[i] + 11))
+                {
+                    errx(EXIT_FAILURE, "unknown binarization %s (otsu, sauvola or niblack)", argv[i] + 11);
+                }
+            }
+            else if (strncmp(argv[i], "--corpus=", 9) == 0)
+            {
+                corpus = argv[i] + 9;
+            }
+            else if (strncmp(argv[i], "--labels=", 9) == 0)
+            {
+                labels = argv[i] + 9;
+            }
+            else if (strncmp(argv[i], "--model=", 8) == 0)
+            {
+                model = argv[i] + 8;
+            }
+            else if (sscanf(argv[i], "--writers=%d", &writers) == 1)
+            {
+                writer_set_threads(writers);
+            }
+            else if (sscanf(argv[i], "--window=%d", &window) == 1)
+            {
+                binarize_set_window(window);
+            }
+            else if (strncmp(argv[i], "--rotate=", 9) == 0)
+            {
+                if (!rotate_set_mode(argv[i] + 9))
+                {
+                    errx(EXIT_FAILURE, "unknown rotation mode %s (nearest or bilinear)", argv[i] + 9);
+                }
+            }
+            else if (sscanf(argv[i], "--median=%d", &median) != 1)
+            {
+                errx(EXIT_FAILURE, "unknown headless option %s", argv[i]);
+            }
+        }
+
+        if (corpus && model)
+        {
+            errx(EXIT_FAILURE, "the letters go either to a corpus or to a model");
+        }
+
+        if (labels && !corpus)
+        {
+            errx(EXIT_FAILURE, "labels are written with the letters of a corpus, --corpus=file is missing");
+        }
+
+        return run_headless(argv[2], median, staged, corpus, labels, model);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--train") == 0)
+    {
+        if(argc < 3)
+        {
+            errx(EXIT_FAILURE, "train needs a corpus file to learn from");
+        }
+
+        return run_train(argv[2], argc - 3, argv + 3);
+    }
+
     if(argc > 4)
     {
         errx(EXIT_FAILURE, "too much arguments");
@@ -108,6 +467,26 @@ int main(int argc, char *argv[])
         return run_mlp();
     }
 
+    if (argc > 1 && strcmp(argv[1], "--corpus") == 0)
+    {
+        if(argc < 3)
+        {
+            errx(EXIT_FAILURE, "corpus needs a corpus file to read");
+        }
+
+        return run_corpus(argv[2]);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--model") == 0)
+    {
+        if(argc < 3)
+        {
+            errx(EXIT_FAILURE, "model needs a model file to load");
+        }
+
+        return run_model(argv[2], argc > 3 ? argv[3] : NULL);
+    }
+
     if (argc > 1 && strcmp(argv[1], "--solver") == 0)
     {
         if(argc >= 4)
@@ -129,6 +508,8 @@ int main(int argc, char *argv[])
     SDL_Window *window = NULL;
     SDL_Texture *texture = NULL;
     SDL_Surface *surface = NULL;
+    GrayImage *image = NULL;
+    BitImage *bits = NULL;
 
     if (argc < 2)
     {
@@ -148,13 +529,16 @@ int main(int argc, char *argv[])
 
     while (running)
     {
-    running = event_handler(renderer, &texture, &surface, &steps, hist, file);
+    running = event_handler(renderer, &texture, &surface, &image, &bits, &steps, hist, file);
 
     SDL_RenderCopy(renderer, texture, NULL, NULL);
     SDL_RenderPresent(renderer);
     }
 
+    writer_stop();
     SDL_FreeSurface(surface);
+    gray_free(image);
+    bit_free(bits);
     terminate(window, renderer, texture);
     return EXIT_SUCCESS;
 }
@@ -1,68 +1,312 @@
 #include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <sys/mman.h>
 #include "mlp.h"
+#include "../gemm/gemm.h"
 
-static inline double sigmoid(double z) { return 1.0 / (1.0 + exp(-z)); }
+// a stack of dense layers, relu between them and a softmax over the classes at the end.
+// every weight and bias of the model is in one float block, so the model can be copied, written or
+// reduced in one go, and every layer starts on a 64 bytes boundary of it.
+// the passes work on a whole minibatch : rows of the input matrix are samples, one layer is a matrix product.
 
-MLP *mlp_create(int in, int hid) 
+#define MLP_ALIGN 16    // floats
+
+static size_t align_floats(size_t n)
+{
+    return (n + MLP_ALIGN - 1) & ~(size_t)(MLP_ALIGN - 1);
+}
+
+static float *aligned_floats(size_t n)
+{
+    float *p = aligned_alloc(MLP_ALIGN * sizeof(float), align_floats(n ? n : 1) * sizeof(float));
+
+    if (!p)
+    {
+        errx(EXIT_FAILURE, "mlp: out of memory");
+    }
+
+    return p;
+}
+
+static unsigned next_random(unsigned *state)     // xorshift, the same weights for the same seed everywhere
+{
+    unsigned x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *state = x;
+}
+
+void mlp_layout(MLP *m)     // offsets of the layers in params from layers and sizes, and the size of params
+{
+    size_t count = 0;
+
+    for (int l = 0; l < m -> layers; l++)
+    {
+        m -> weights[l] = count;
+        count = align_floats(count + (size_t)m -> sizes[l + 1] * m -> sizes[l]);
+
+        m -> biases[l] = count;
+        count = align_floats(count + m -> sizes[l + 1]);
+    }
+
+    m -> count = count;
+}
+
+MLP *mlp_create(int layers, const int *sizes, unsigned seed)     // sizes : layers + 1 values, inputs first, classes last
 {
-    MLP *m = (MLP *)calloc(1, sizeof(MLP));
-    m -> in = in; m -> hid = hid;
-    m -> W1 = (double *)malloc(sizeof(double) * hid * in);
-    m -> b1 = (double *)calloc(hid, sizeof(double));
-    m -> W2 = (double *)malloc(sizeof(double) * hid);
-    m -> b2 = 0.0;
-    for (int i = 0; i < hid * in; ++i) m -> W1[i] = ((rand()%2000) / 1000.0 - 1.0) * 0.1;
-    for (int i = 0; i < hid; ++i) m -> W2[i] = ((rand()%2000) / 1000.0 - 1.0) * 0.1;
+    if (layers < 1 || layers > MLP_MAX_LAYERS)
+    {
+        errx(EXIT_FAILURE, "mlp: between 1 and %d layers (got %d)", MLP_MAX_LAYERS, layers);
+    }
+
+    MLP *m = calloc(1, sizeof(MLP));
+
+    if (!m)
+    {
+        errx(EXIT_FAILURE, "mlp: out of memory");
+    }
+
+    m -> layers = layers;
+
+    for (int l = 0; l <= layers; l++)
+    {
+        if (sizes[l] < 1)
+        {
+            errx(EXIT_FAILURE, "mlp: layer %d has no unit", l);
+        }
+
+        m -> sizes[l] = sizes[l];
+    }
+
+    mlp_layout(m);
+
+    m -> params = aligned_floats(m -> count);
+    memset(m -> params, 0, m -> count * sizeof(float));
+
+    unsigned state = seed ? seed : 1;
+
+    for (int l = 0; l < layers; l++)
+    {
+        int in = sizes[l], out = sizes[l + 1];
+
+        // he for the relu layers, glorot for the softmax one
+        float a = (l + 1 < layers) ? sqrtf(6.0f / in) : sqrtf(6.0f / (in + out));
+        float *w = mlp_weights(m, l);
+
+        for (size_t i = 0; i < (size_t)out * in; i++)
+        {
+            w[i] = a * ((float)(next_random(&state) >> 8) / 8388608.0f - 1.0f);     // uniform in -a .. a
+        }
+    }
+
     return m;
 }
 
-void mlp_free(MLP *m) {
-    if (!m) return;
-    free(m -> W1); free(m -> b1); free(m -> W2);
+void mlp_free(MLP *m)
+{
+    if (!m)
+        return;
+
+    if (m -> mapping) munmap(m -> mapping, m -> mapped);
+    else free(m -> params);
+
     free(m);
 }
-    
-double mlp_forward(const MLP *m, const double *x, double *h) 
+
+MLPWork *mlp_work_create(const MLP *m, int capacity)
+{
+    MLPWork *work = calloc(1, sizeof(MLPWork));
+
+    if (!work)
+    {
+        errx(EXIT_FAILURE, "mlp: out of memory");
+    }
+
+    work -> capacity = capacity;
+
+    for (int l = 1; l <= m -> layers; l++)
+    {
+        work -> act[l] = aligned_floats((size_t)capacity * m -> sizes[l]);
+        work -> delta[l] = aligned_floats((size_t)capacity * m -> sizes[l]);
+    }
+
+    work -> grad = aligned_floats(m -> count);
+    memset(work -> grad, 0, m -> count * sizeof(float));     // the padding between layers stays 0
+
+    work -> pack = aligned_floats(gemm_pack_floats());
+
+    return work;
+}
+
+void mlp_work_free(MLPWork *work)
+{
+    if (!work)
+        return;
+
+    for (int l = 1; l <= MLP_MAX_LAYERS; l++)
+    {
+        free(work -> act[l]);
+        free(work -> delta[l]);
+    }
+
+    free(work -> grad);
+    free(work -> pack);
+    free(work);
+}
+
+// the three products of a dense layer, x : n x in, w : out x in, y : n x out, all through gemm
+
+static void dense_forward(const float *x, int n, int in, const float *w, const float *b, int out, float *y, float *pack)    // y = x w^T + b
 {
-    for (int j = 0; j < m -> hid; ++j) 
+    for (int r = 0; r < n; r++)
     {
-        double z= m -> b1[j];
-        for (int i = 0; i < m -> in; ++i) z += m -> W1[j * m -> in + i] * x[i];
-        h[j] = sigmoid(z);
+        memcpy(y + (size_t)r * out, b, out * sizeof(float));
     }
-    double z = m -> b2;
-    for (int j = 0; j < m -> hid; ++j) z += m -> W2[j] * h[j];
-    return sigmoid(z);
+
+    gemm(0, 1, n, out, in, x, in, w, in, 1.0f, y, out, pack);
 }
 
-void mlp_backward(MLP *m, const double *x, const double *h, double y, double t, double lr) 
+static void dense_grad_weights(const float *dy, const float *x, int n, int in, int out, float *dw, float *db, float *pack)    // dw = dy^T x, db = column sums of dy
 {
-    double dldy = (y - t); // derivative for BCE with sigmoid
+    gemm(1, 0, out, in, n, dy, out, x, in, 0.0f, dw, in, pack);
 
-    // update output weights
-    for (int j = 0; j < m -> hid; ++j) 
+    memset(db, 0, out * sizeof(float));
+
+    for (int r = 0; r < n; r++)
+    {
+        const float *dyr = dy + (size_t)r * out;
+
+        for (int j = 0; j < out; j++) db[j] += dyr[j];
+    }
+}
+
+static void dense_grad_input(const float *dy, const float *w, int n, int in, int out, float *dx, float *pack)    // dx = dy w
+{
+    gemm(0, 0, n, in, out, dy, out, w, in, 0.0f, dx, in, pack);
+}
+
+static void softmax_rows(float *y, int n, int classes)
+{
+    for (int r = 0; r < n; r++)
     {
-        m -> W2[j] -= lr * dldy * h[j];
+        float *yr = y + (size_t)r * classes;
+        float max = yr[0];
+
+        for (int c = 1; c < classes; c++)
+        {
+            if (yr[c] > max) max = yr[c];
+        }
+
+        float sum = 0.0f;
+
+        for (int c = 0; c < classes; c++)
+        {
+            yr[c] = expf(yr[c] - max);
+            sum += yr[c];
+        }
+
+        for (int c = 0; c < classes; c++)
+        {
+            yr[c] /= sum;
+        }
     }
-    m -> b2 -= lr * dldy;
+}
 
-    // backpropagate to hidden
-    double dh[m -> hid];
-    for (int j = 0; j < m -> hid; ++j) 
+const float *mlp_forward(const MLP *m, MLPWork *work, const float *x, int n)     // x : n x inputs, returns n x classes probabilities
+{
+    if (n > work -> capacity)
     {
-        double d = m -> W2[j] * dldy;
-        dh[j] = d * h[j] * (1.0 - h[j]);
+        errx(EXIT_FAILURE, "mlp_forward: %d samples for a work of %d", n, work -> capacity);
     }
 
-    // update input -> hidden weights
-    for (int j = 0; j < m -> hid; ++j) 
+    work -> act[0] = (float *)x;    // only read
+
+    for (int l = 0; l < m -> layers; l++)
     {
-        for (int i = 0; i < m -> in; ++i)
+        int in = m -> sizes[l], out = m -> sizes[l + 1];
+        float *y = work -> act[l + 1];
+
+        dense_forward(work -> act[l], n, in, mlp_weights(m, l), mlp_bias(m, l), out, y, work -> pack);
+
+        if (l + 1 < m -> layers)
         {
-            m -> W1[j * m -> in + i] -= lr * dh[j] * x[i];
+            for (size_t i = 0; i < (size_t)n * out; i++)
+            {
+                if (y[i] < 0.0f) y[i] = 0.0f;
+            }
         }
+    }
+
+    softmax_rows(work -> act[m -> layers], n, mlp_classes(m));
 
-        m -> b1[j] -= lr * dh[j];
+    return work -> act[m -> layers];
+}
+
+// after mlp_forward on the same work : the gradient of the mean cross entropy goes to work -> grad, returns the loss
+float mlp_backward(const MLP *m, MLPWork *work, const int *labels, int n)
+{
+    int classes = mlp_classes(m);
+    const float *p = work -> act[m -> layers];
+    float *d = work -> delta[m -> layers];
+
+    float loss = 0.0f;
+    float scale = 1.0f / n;
+
+    for (int r = 0; r < n; r++)      // softmax and cross entropy together : p - one hot
+    {
+        for (int c = 0; c < classes; c++)
+        {
+            d[(size_t)r * classes + c] = p[(size_t)r * classes + c] * scale;
+        }
+
+        d[(size_t)r * classes + labels[r]] -= scale;
+        loss -= logf(p[(size_t)r * classes + labels[r]] + 1e-8f);
     }
-}
\ No newline at end of file
+
+    for (int l = m -> layers - 1; l >= 0; l--)
+    {
+        int in = m -> sizes[l], out = m -> sizes[l + 1];
+
+        dense_grad_weights(work -> delta[l + 1], work -> act[l], n, in, out, work -> grad + m -> weights[l], work -> grad + m -> biases[l], work -> pack);
+
+        if (l == 0) break;     // no gradient for the input
+
+        float *dx = work -> delta[l];
+        const float *x = work -> act[l];
+
+        dense_grad_input(work -> delta[l + 1], mlp_weights(m, l), n, in, out, dx, work -> pack);
+
+        for (size_t i = 0; i < (size_t)n * in; i++)     // relu
+        {
+            if (x[i] <= 0.0f) dx[i] = 0.0f;
+        }
+    }
+
+    return loss * scale;
+}
+
+void mlp_step(MLP *m, const float *grad, float lr)    // plain gradient descent
+{
+    for (size_t i = 0; i < m -> count; i++)
+    {
+        m -> params[i] -= lr * grad[i];
+    }
+}
+
+int mlp_argmax(const float *p, int classes)
+{
+    int best = 0;
+
+    for (int c = 1; c < classes; c++)
+    {
+        if (p[c] > p[best]) best = c;
+    }
+
+    return best;
+}
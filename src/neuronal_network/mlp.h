@@ -1,18 +1,80 @@
 #ifndef MLP_H
 #define MLP_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+#define MLP_MAX_LAYERS 8
+#define MLP_CLASSES 26          // one output per letter
+
 typedef struct {
-    int in, hid;
-    double *W1; // hid x in
-    double *b1; // hid
-    double *W2; // 1 x hid
-    double b2; // scalar
+    int layers;                         // dense layers, relu between them, softmax after the last one
+    int sizes[MLP_MAX_LAYERS + 1];      // sizes[0] inputs, sizes[l + 1] outputs of layer l
+    size_t weights[MLP_MAX_LAYERS];     // offset of the weights of layer l in params, out x in, row major
+    size_t biases[MLP_MAX_LAYERS];      // offset of its biases
+    size_t count;                       // floats of the whole model
+    float *params;                      // every weight and bias, layer after layer, in one block
+    void *mapping;                      // the model file when loaded, params point into it
+    size_t mapped;
 } MLP;
 
-MLP *mlp_create(int in, int hid);
+#define MLP_MAGIC "OCRMODEL"
+#define MLP_VERSION 2
+#define MLP_DTYPE_F32 1
+#define MLP_BYTE_ORDER 0x01020304u             // reads 0x04030201 on a machine of the other byte order
+
+// model file, in the byte order of the machine that saved it : header | params, the layout of params in memory as is
+// params start at 128 bytes so every layer stays 64 bytes aligned in the mapping
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;                         // MLP_DTYPE_F32
+    uint32_t layers;
+    uint32_t sizes[MLP_MAX_LAYERS + 1];
+    uint32_t byte_order;                    // MLP_BYTE_ORDER as the saving machine stores it
+    uint64_t params_offset;                 // bytes from the start of the file
+    uint64_t count;                         // values of params
+    uint64_t checksum;                      // fnv-1a of the params bytes
+    uint8_t reserved[40];
+} MLPFileHeader;                            // 128 bytes
+
+typedef struct {
+    int capacity;                           // rows of a minibatch
+    float *act[MLP_MAX_LAYERS + 1];         // act[l + 1] : outputs of layer l, rows x sizes[l + 1], act[0] is the input
+    float *delta[MLP_MAX_LAYERS + 1];       // gradient of the loss for the same values
+    float *grad;                            // gradient of the loss for params, same layout
+    float *pack;                            // blocks of the matrix products
+} MLPWork;                                  // buffers of a minibatch, one per thread
+
+MLP *mlp_create(int layers, const int *sizes, unsigned seed);
+void mlp_layout(MLP *m);
 void mlp_free(MLP *m);
 
-double mlp_forward(const MLP *m, const double *x, double *h);
-void mlp_backward(MLP *m, const double *x, const double *h, double y, double t, double lr);
+void mlp_save(const MLP *m, const char *path);
+MLP *mlp_load(const char *path, int verify);
+
+MLPWork *mlp_work_create(const MLP *m, int capacity);
+void mlp_work_free(MLPWork *work);
+
+const float *mlp_forward(const MLP *m, MLPWork *work, const float *x, int n);
+float mlp_backward(const MLP *m, MLPWork *work, const int *labels, int n);
+void mlp_step(MLP *m, const float *grad, float lr);
+int mlp_argmax(const float *p, int classes);
+
+static inline float *mlp_weights(const MLP *m, int l)
+{
+    return m -> params + m -> weights[l];
+}
+
+static inline float *mlp_bias(const MLP *m, int l)
+{
+    return m -> params + m -> biases[l];
+}
+
+static inline int mlp_classes(const MLP *m)
+{
+    return m -> sizes[m -> layers];
+}
 
-#endif
\ No newline at end of file
+#endif
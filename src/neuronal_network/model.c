@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mlp.h"
+
+// model files : the header gives the shape of the network, the params block follows as it is in memory.
+// loading maps the file and the model uses the weights in place, nothing is read before a layer needs it
+// and every process on the same file shares the page cache. the mapping is private, a model that is trained
+// further gets its own copy of the pages it changes and the file stays as it was.
+
+#define MLP_PARAMS_OFFSET 128
+
+_Static_assert(sizeof(MLPFileHeader) == MLP_PARAMS_OFFSET, "model header must stay 128 bytes");
+
+static uint64_t checksum(const float *params, size_t count)     // fnv-1a, 64 bits
+{
+    const uint8_t *bytes = (const uint8_t *)params;
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < count * sizeof(float); i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+void mlp_save(const MLP *m, const char *path)     // written next to the file then renamed, a process mapping the old model keeps it
+{
+    MLPFileHeader header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, MLP_MAGIC, 8);
+    header.version = MLP_VERSION;
+    header.dtype = MLP_DTYPE_F32;
+    header.byte_order = MLP_BYTE_ORDER;
+    header.layers = (uint32_t)m -> layers;
+
+    for (int l = 0; l <= m -> layers; l++)
+    {
+        header.sizes[l] = (uint32_t)m -> sizes[l];
+    }
+
+    header.params_offset = MLP_PARAMS_OFFSET;
+    header.count = m -> count;
+    header.checksum = checksum(m -> params, m -> count);
+
+    size_t len = strlen(path);
+    char *temp = malloc(len + 5);
+
+    if (!temp)
+    {
+        errx(EXIT_FAILURE, "mlp: out of memory");
+    }
+
+    memcpy(temp, path, len);
+    memcpy(temp + len, ".tmp", 5);
+
+    FILE *file = fopen(temp, "wb");
+
+    if (!file)
+        err(EXIT_FAILURE, "mlp: %s", temp);
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1
+        || fwrite(m -> params, sizeof(float), m -> count, file) != m -> count
+        || fclose(file) != 0)
+        err(EXIT_FAILURE, "mlp: %s", temp);
+
+    if (rename(temp, path) != 0)
+        err(EXIT_FAILURE, "mlp: %s", path);
+
+    free(temp);
+}
+
+MLP *mlp_load(const char *path, int verify)     // verify : also checks the params against the checksum, reading all of them
+{
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+
+    if (fd < 0 || fstat(fd, &info) != 0)
+        err(EXIT_FAILURE, "mlp: %s", path);
+
+    if ((size_t)info.st_size < sizeof(MLPFileHeader))
+        errx(EXIT_FAILURE, "mlp: %s is not a model", path);
+
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+        err(EXIT_FAILURE, "mlp: %s", path);
+
+    const MLPFileHeader *header = data;
+
+    if (memcmp(header -> magic, MLP_MAGIC, 8) != 0)
+        errx(EXIT_FAILURE, "mlp: %s is not a model", path);
+
+    if (header -> byte_order == __builtin_bswap32(MLP_BYTE_ORDER))
+        errx(EXIT_FAILURE, "mlp: %s was saved on a machine of the other byte order", path);
+
+    if (header -> version != MLP_VERSION || header -> dtype != MLP_DTYPE_F32)
+        errx(EXIT_FAILURE, "mlp: %s has version %u and type %u, expected version %d and type %d",
+             path, header -> version, header -> dtype, MLP_VERSION, MLP_DTYPE_F32);
+
+    if (header -> byte_order != MLP_BYTE_ORDER)
+        errx(EXIT_FAILURE, "mlp: %s has byte order mark %#x, expected %#x", path, header -> byte_order, MLP_BYTE_ORDER);
+
+    if (header -> layers < 1 || header -> layers > MLP_MAX_LAYERS)
+        errx(EXIT_FAILURE, "mlp: %s has %u layers", path, header -> layers);
+
+    MLP *m = calloc(1, sizeof(MLP));
+
+    if (!m)
+    {
+        errx(EXIT_FAILURE, "mlp: out of memory");
+    }
+
+    m -> layers = (int)header -> layers;
+
+    for (int l = 0; l <= m -> layers; l++)
+    {
+        if (header -> sizes[l] < 1 || header -> sizes[l] > (1 << 24))
+            errx(EXIT_FAILURE, "mlp: %s has a layer of %u units", path, header -> sizes[l]);
+
+        m -> sizes[l] = (int)header -> sizes[l];
+    }
+
+    mlp_layout(m);
+
+    if (header -> count != m -> count)
+        errx(EXIT_FAILURE, "mlp: %s has %llu parameters, its layers have %zu", path, (unsigned long long)header -> count, m -> count);
+
+    if (header -> params_offset % 64 != 0)
+        errx(EXIT_FAILURE, "mlp: %s has its parameters at %llu, not 64 bytes aligned", path, (unsigned long long)header -> params_offset);
+
+    uint64_t expected = header -> params_offset + m -> count * sizeof(float);
+
+    if (header -> params_offset > (uint64_t)info.st_size || expected != (uint64_t)info.st_size)
+        errx(EXIT_FAILURE, "mlp: %s is %lld bytes, expected %llu", path, (long long)info.st_size, (unsigned long long)expected);
+
+    m -> params = (float *)((uint8_t *)data + header -> params_offset);
+    m -> mapping = data;
+    m -> mapped = (size_t)info.st_size;
+
+    if (verify && checksum(m -> params, m -> count) != header -> checksum)
+        errx(EXIT_FAILURE, "mlp: %s is corrupted, the checksum does not match", path);
+
+    return m;
+}
@@ -0,0 +1,378 @@
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <SDL2/SDL.h>
+#include "quantize.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define QMLP_SIMD 1
+#endif
+
+// int8 inference for a trained model. the weights of every output get their own scale (largest weight -> 127),
+// the inputs of every layer get one scale from a calibration pass : the largest value the float model gives
+// on sample glyphs -> 127. inputs and hidden outputs are never negative (pixels, relu) so they are unsigned,
+// and with 7 bits a pair of products stays below 2^15, the 16 bits sums of vpmaddubsw can not saturate.
+// a layer is an integer dot product per output, the scale turns it back to float before the bias and relu.
+
+#define QMLP_CALIBRATION_BATCH 256
+
+typedef void (*dot4x2_fn)(const uint8_t *x0, const uint8_t *x1, const int8_t *w, int stride, int32_t *out);
+
+static void *checked_aligned(size_t size)
+{
+    void *p = aligned_alloc(64, (size + 63) & ~(size_t)63);
+
+    if (!p)
+    {
+        errx(EXIT_FAILURE, "quantize: out of memory");
+    }
+
+    return p;
+}
+
+static void dot4x2_scalar(const uint8_t *x0, const uint8_t *x1, const int8_t *w, int stride, int32_t *out)     // 4 weight rows against two input rows, out : 4 sums of x0 then 4 of x1
+{
+    for (int r = 0; r < 4; r++)
+    {
+        const int8_t *wr = w + (size_t)r * stride;
+        int32_t sum0 = 0, sum1 = 0;
+
+        for (int i = 0; i < stride; i++)
+        {
+            sum0 += x0[i] * wr[i];
+            sum1 += x1[i] * wr[i];
+        }
+
+        out[r] = sum0;
+        out[4 + r] = sum1;
+    }
+}
+
+#ifdef QMLP_SIMD
+
+// 32 products a step per row and sample : every weight load serves both samples and every input load the 4 rows,
+// the 8 accumulators, 4 weights and the input fit in the 16 registers
+__attribute__((target("avx2")))
+static void dot4x2_avx2(const uint8_t *x0, const uint8_t *x1, const int8_t *w, int stride, int32_t *out)
+{
+    __m256i ones = _mm256_set1_epi16(1);
+    __m256i a00 = _mm256_setzero_si256(), a01 = _mm256_setzero_si256(), a02 = _mm256_setzero_si256(), a03 = _mm256_setzero_si256();
+    __m256i a10 = _mm256_setzero_si256(), a11 = _mm256_setzero_si256(), a12 = _mm256_setzero_si256(), a13 = _mm256_setzero_si256();
+
+    for (int i = 0; i < stride; i += 32)
+    {
+        __m256i w0 = _mm256_load_si256((const __m256i *)(w + i));
+        __m256i w1 = _mm256_load_si256((const __m256i *)(w + stride + i));
+        __m256i w2 = _mm256_load_si256((const __m256i *)(w + 2 * stride + i));
+        __m256i w3 = _mm256_load_si256((const __m256i *)(w + 3 * stride + i));
+
+        // u8 x s8 pairs added into 16 bits, then pairs of those into 32 bits
+        __m256i xv = _mm256_load_si256((const __m256i *)(x0 + i));
+
+        a00 = _mm256_add_epi32(a00, _mm256_madd_epi16(_mm256_maddubs_epi16(xv, w0), ones));
+        a01 = _mm256_add_epi32(a01, _mm256_madd_epi16(_mm256_maddubs_epi16(xv, w1), ones));
+        a02 = _mm256_add_epi32(a02, _mm256_madd_epi16(_mm256_maddubs_epi16(xv, w2), ones));
+        a03 = _mm256_add_epi32(a03, _mm256_madd_epi16(_mm256_maddubs_epi16(xv, w3), ones));
+
+        xv = _mm256_load_si256((const __m256i *)(x1 + i));
+
+        a10 = _mm256_add_epi32(a10, _mm256_madd_epi16(_mm256_maddubs_epi16(xv, w0), ones));
+        a11 = _mm256_add_epi32(a11, _mm256_madd_epi16(_mm256_maddubs_epi16(xv, w1), ones));
+        a12 = _mm256_add_epi32(a12, _mm256_madd_epi16(_mm256_maddubs_epi16(xv, w2), ones));
+        a13 = _mm256_add_epi32(a13, _mm256_madd_epi16(_mm256_maddubs_epi16(xv, w3), ones));
+    }
+
+    __m256i sums0 = _mm256_hadd_epi32(_mm256_hadd_epi32(a00, a01), _mm256_hadd_epi32(a02, a03));     // 4 sums per 128 bits lane
+    __m256i sums1 = _mm256_hadd_epi32(_mm256_hadd_epi32(a10, a11), _mm256_hadd_epi32(a12, a13));
+
+    // low lanes of both samples plus their high lanes : the 4 sums of x0, then the 4 of x1
+    __m256i total = _mm256_add_epi32(_mm256_permute2x128_si256(sums0, sums1, 0x20), _mm256_permute2x128_si256(sums0, sums1, 0x31));
+
+    _mm256_storeu_si256((__m256i *)out, total);
+}
+
+#endif
+
+static dot4x2_fn pick_dot4x2(void)  // chosen at runtime so one binary runs everywhere
+{
+#ifdef QMLP_SIMD
+    if (SDL_HasAVX2()) return dot4x2_avx2;
+#endif
+    return dot4x2_scalar;
+}
+
+static int round_up(int n, int to)
+{
+    return (n + to - 1) / to * to;
+}
+
+static int max_width(const QMLP *q)
+{
+    int width = 0;
+
+    for (int l = 0; l < q -> layers; l++)
+    {
+        if (q -> stride[l] > width) width = q -> stride[l];
+        if (q -> rows[l] > width) width = q -> rows[l];
+    }
+
+    return width;
+}
+
+// largest input of every layer over the samples (n x inputs), run through the float model
+static void calibrate(const MLP *m, const float *samples, int n, float *largest)
+{
+    MLPWork *work = mlp_work_create(m, QMLP_CALIBRATION_BATCH);
+
+    for (int l = 0; l < m -> layers; l++) largest[l] = 0.0f;
+
+    for (int first = 0; first < n; first += QMLP_CALIBRATION_BATCH)
+    {
+        int count = n - first < QMLP_CALIBRATION_BATCH ? n - first : QMLP_CALIBRATION_BATCH;
+        const float *x = samples + (size_t)first * m -> sizes[0];
+
+        mlp_forward(m, work, x, count);
+
+        for (int l = 0; l < m -> layers; l++)
+        {
+            const float *act = (l == 0) ? x : work -> act[l];
+
+            for (size_t i = 0; i < (size_t)count * m -> sizes[l]; i++)
+            {
+                if (act[i] > largest[l]) largest[l] = act[i];
+            }
+        }
+    }
+
+    mlp_work_free(work);
+}
+
+QMLP *qmlp_quantize(const MLP *m, const float *samples, int n)     // samples : n x inputs, glyphs like the ones to classify
+{
+    QMLP *q = calloc(1, sizeof(QMLP));
+
+    if (!q)
+    {
+        errx(EXIT_FAILURE, "quantize: out of memory");
+    }
+
+    float largest[MLP_MAX_LAYERS];
+    calibrate(m, samples, n, largest);
+
+    q -> layers = m -> layers;
+    memcpy(q -> sizes, m -> sizes, sizeof(q -> sizes));
+
+    for (int l = 0; l < m -> layers; l++)
+    {
+        int in = m -> sizes[l], out = m -> sizes[l + 1];
+
+        q -> stride[l] = round_up(in, 32);
+        q -> rows[l] = round_up(out, 4);
+        q -> input_scale[l] = (largest[l] > 0.0f ? largest[l] : 1.0f) / QMLP_LEVELS;
+
+        q -> weights[l] = checked_aligned((size_t)q -> rows[l] * q -> stride[l]);
+        q -> scales[l] = checked_aligned(q -> rows[l] * sizeof(float));
+        q -> biases[l] = checked_aligned(q -> rows[l] * sizeof(float));
+
+        memset(q -> weights[l], 0, (size_t)q -> rows[l] * q -> stride[l]);
+        memset(q -> scales[l], 0, q -> rows[l] * sizeof(float));
+        memset(q -> biases[l], 0, q -> rows[l] * sizeof(float));
+
+        const float *w = mlp_weights(m, l);
+
+        for (int j = 0; j < out; j++)
+        {
+            const float *wj = w + (size_t)j * in;
+            int8_t *qj = q -> weights[l] + (size_t)j * q -> stride[l];
+            float top = 0.0f;
+
+            for (int i = 0; i < in; i++)
+            {
+                if (fabsf(wj[i]) > top) top = fabsf(wj[i]);
+            }
+
+            float step = (top > 0.0f ? top : 1.0f) / QMLP_LEVELS;
+
+            for (int i = 0; i < in; i++)
+            {
+                qj[i] = (int8_t)lrintf(wj[i] / step);
+            }
+
+            q -> scales[l][j] = q -> input_scale[l] * step;
+            q -> biases[l][j] = mlp_bias(m, l)[j];
+        }
+    }
+
+    return q;
+}
+
+void qmlp_free(QMLP *q)
+{
+    if (!q)
+        return;
+
+    for (int l = 0; l < q -> layers; l++)
+    {
+        free(q -> weights[l]);
+        free(q -> scales[l]);
+        free(q -> biases[l]);
+    }
+
+    free(q);
+}
+
+size_t qmlp_bytes(const QMLP *q)     // memory of the weights, scales and biases
+{
+    size_t bytes = 0;
+
+    for (int l = 0; l < q -> layers; l++)
+    {
+        bytes += (size_t)q -> rows[l] * q -> stride[l] + 2 * q -> rows[l] * sizeof(float);
+    }
+
+    return bytes;
+}
+
+static void quantize_scalar(const float *y, int width, float inverse, uint8_t *q)     // never negative, rounded to even, capped at 127
+{
+    for (int i = 0; i < width; i++)
+    {
+        long v = lrintf(y[i] * inverse);
+        q[i] = v <= 0 ? 0 : (v >= QMLP_LEVELS ? QMLP_LEVELS : (uint8_t)v);
+    }
+}
+
+#ifdef QMLP_SIMD
+
+__attribute__((target("avx2")))
+static void quantize_avx2(const float *y, int width, float inverse, uint8_t *q)
+{
+    __m256 scale = _mm256_set1_ps(inverse);
+    __m256i top = _mm256_set1_epi8(QMLP_LEVELS);
+    __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);   // packs work per 128 bit lane, put the dwords back in order
+
+    int i = 0;
+
+    for (; i + 32 <= width; i += 32)    // 32 floats in, 32 bytes out, the packs saturate below 0
+    {
+        __m256i v0 = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(y + i), scale));
+        __m256i v1 = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(y + i + 8), scale));
+        __m256i v2 = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(y + i + 16), scale));
+        __m256i v3 = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(y + i + 24), scale));
+
+        __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(v0, v1), _mm256_packs_epi32(v2, v3));
+        packed = _mm256_min_epu8(_mm256_permutevar8x32_epi32(packed, order), top);
+
+        _mm256_storeu_si256((__m256i *)(q + i), packed);
+    }
+
+    quantize_scalar(y + i, width - i, inverse, q + i);
+}
+
+#endif
+
+static void quantize_rows(const float *y, int n, int width, int ld, float scale, uint8_t *qx, int stride)
+{
+    void (*quantize)(const float *, int, float, uint8_t *) = quantize_scalar;
+
+#ifdef QMLP_SIMD
+    if (SDL_HasAVX2()) quantize = quantize_avx2;
+#endif
+
+    for (int r = 0; r < n; r++)
+    {
+        uint8_t *qr = qx + (size_t)r * stride;
+
+        quantize(y + (size_t)r * ld, width, 1.0f / scale, qr);
+        memset(qr + width, 0, stride - width);
+    }
+}
+
+QMLPWork *qmlp_work_create(const QMLP *q, int capacity)
+{
+    QMLPWork *work = calloc(1, sizeof(QMLPWork));
+
+    if (!work)
+    {
+        errx(EXIT_FAILURE, "quantize: out of memory");
+    }
+
+    int width = max_width(q);
+
+    work -> capacity = capacity;
+    work -> qx = checked_aligned((size_t)capacity * width);
+    work -> y = checked_aligned((size_t)capacity * width * sizeof(float));
+
+    return work;
+}
+
+void qmlp_work_free(QMLPWork *work)
+{
+    if (!work)
+        return;
+
+    free(work -> qx);
+    free(work -> y);
+    free(work);
+}
+
+// x : n x inputs, scores : n x classes, the largest is the letter
+void qmlp_forward(const QMLP *q, QMLPWork *work, const float *x, int n, float *scores)
+{
+    if (n > work -> capacity)
+    {
+        errx(EXIT_FAILURE, "qmlp_forward: %d samples for a work of %d", n, work -> capacity);
+    }
+
+    uint8_t *qx = work -> qx;
+    float *y = work -> y;
+    dot4x2_fn dot4x2 = pick_dot4x2();
+
+    quantize_rows(x, n, q -> sizes[0], q -> sizes[0], q -> input_scale[0], qx, q -> stride[0]);
+
+    for (int l = 0; l < q -> layers; l++)
+    {
+        int stride = q -> stride[l], rows = q -> rows[l];
+        int last = (l + 1 == q -> layers);
+
+        for (int j = 0; j < rows; j += 4)     // 4 weight rows stay in cache for every sample
+        {
+            const int8_t *w = q -> weights[l] + (size_t)j * stride;
+
+            for (int r = 0; r < n; r += 2)
+            {
+                int pair = (r + 1 < n) ? 2 : 1;     // a last sample alone is paired with itself
+                const uint8_t *x0 = qx + (size_t)r * stride;
+                int32_t sums[8];
+
+                dot4x2(x0, x0 + (size_t)(pair - 1) * stride, w, stride, sums);
+
+                for (int s = 0; s < pair; s++)
+                {
+                    float *yr = y + (size_t)(r + s) * rows + j;
+
+                    for (int k = 0; k < 4; k++)
+                    {
+                        float v = sums[4 * s + k] * q -> scales[l][j + k] + q -> biases[l][j + k];
+                        yr[k] = (last || v > 0.0f) ? v : 0.0f;
+                    }
+                }
+            }
+        }
+
+        if (!last)
+        {
+            quantize_rows(y, n, q -> sizes[l + 1], rows, q -> input_scale[l + 1], qx, q -> stride[l + 1]);
+        }
+    }
+
+    int classes = q -> sizes[q -> layers];
+
+    for (int r = 0; r < n; r++)
+    {
+        memcpy(scores + (size_t)r * classes, y + (size_t)r * q -> rows[q -> layers - 1], classes * sizeof(float));
+    }
+}
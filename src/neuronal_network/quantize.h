@@ -0,0 +1,33 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <stdint.h>
+#include "mlp.h"
+
+#define QMLP_LEVELS 127         // activations 0 .. 127 and weights -127 .. 127, a pair of products fits in 16 bits
+
+typedef struct {
+    int layers;
+    int sizes[MLP_MAX_LAYERS + 1];
+    int stride[MLP_MAX_LAYERS];             // inputs of layer l padded to 32 bytes
+    int rows[MLP_MAX_LAYERS];               // outputs of layer l padded to 4
+    int8_t *weights[MLP_MAX_LAYERS];        // rows x stride, one scale per row
+    float *scales[MLP_MAX_LAYERS];          // input scale x row scale, the value of one unit of the product
+    float *biases[MLP_MAX_LAYERS];
+    float input_scale[MLP_MAX_LAYERS];      // value of one step of the inputs of layer l, from the calibration
+} QMLP;
+
+typedef struct {
+    int capacity;                           // samples of a call
+    uint8_t *qx;                            // quantized inputs of the current layer
+    float *y;                               // outputs of the current layer
+} QMLPWork;                                 // buffers of qmlp_forward, reused from call to call
+
+QMLP *qmlp_quantize(const MLP *m, const float *samples, int n);
+void qmlp_free(QMLP *q);
+size_t qmlp_bytes(const QMLP *q);
+QMLPWork *qmlp_work_create(const QMLP *q, int capacity);
+void qmlp_work_free(QMLPWork *work);
+void qmlp_forward(const QMLP *q, QMLPWork *work, const float *x, int n, float *scores);
+
+#endif
@@ -0,0 +1,518 @@
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "train.h"
+#include "../parallel/parallel.h"
+
+// training of the letter recognizer on the labeled glyphs of a packed corpus.
+// the corpus stays mapped, a minibatch is gathered from its tiles into one float matrix.
+// every tenth labeled glyph is kept aside to measure the accuracy on glyphs the network did not learn.
+// the threads share a minibatch : each one runs its rows with its own work and gradient, then the gradients
+// are added in shard order, so a run gives the same model every time. the threads are given the whole epoch
+// and wait for each other between the rows, the sum and the step, instead of being handed every minibatch. with hogwild every thread runs its own
+// minibatches and updates the shared weights without waiting for the others (faster, not reproducible).
+
+#define TRAIN_VALIDATION 10
+#define TRAIN_REDUCE_CHUNK 16384      // floats of the gradient per reduction task
+#define TRAIN_CALIBRATION 1024        // glyphs the int8 scales are measured on
+
+void train_default_options(TrainOptions *options)
+{
+    memset(options, 0, sizeof(TrainOptions));
+
+    options -> epochs = 10;
+    options -> batch = 64;
+    options -> lr = 0.1f;
+    options -> hidden[0] = 256;
+    options -> hidden[1] = 128;
+    options -> n_hidden = 2;
+    options -> seed = 1;
+    options -> threads = 0;
+    options -> hogwild = 0;
+    options -> save = NULL;
+}
+
+int train_parse_option(TrainOptions *options, const char *arg)     // 0 if the option is unknown
+{
+    if (sscanf(arg, "--epochs=%d", &options -> epochs) == 1) return options -> epochs > 0;
+    if (sscanf(arg, "--batch=%d", &options -> batch) == 1) return options -> batch > 0;
+    if (sscanf(arg, "--lr=%f", &options -> lr) == 1) return options -> lr > 0.0f;
+    if (sscanf(arg, "--seed=%u", &options -> seed) == 1) return 1;
+    if (sscanf(arg, "--threads=%d", &options -> threads) == 1) return options -> threads >= 0;
+    if (strcmp(arg, "--hogwild") == 0) return options -> hogwild = 1;
+    if (strncmp(arg, "--save=", 7) == 0) return (options -> save = arg + 7)[0] != '\0';
+
+    if (strncmp(arg, "--hidden=", 9) == 0)     // units of every hidden layer, --hidden=256,128
+    {
+        const char *p = arg + 9;
+        options -> n_hidden = 0;
+
+        while (*p && options -> n_hidden < MLP_MAX_LAYERS - 1)
+        {
+            char *end;
+            long units = strtol(p, &end, 10);
+
+            if (end == p || units < 1) return 0;
+
+            options -> hidden[options -> n_hidden++] = (int)units;
+            p = (*end == ',') ? end + 1 : end;
+        }
+
+        return *p == '\0';
+    }
+
+    return 0;
+}
+
+static int glyph_class(const CorpusEntry *entry)     // -1 if the glyph has no letter label
+{
+    return (entry -> label >= 'A' && entry -> label <= 'Z') ? entry -> label - 'A' : -1;
+}
+
+static void gather(const Corpus *corpus, const uint64_t *samples, int n, float *x, int *labels)
+{
+    for (int r = 0; r < n; r++)
+    {
+        const uint8_t *tile = corpus_tile(corpus, samples[r]);
+        float *row = x + (size_t)r * CORPUS_TILE_BYTES;
+
+        for (int i = 0; i < CORPUS_TILE_BYTES; i++)
+        {
+            row[i] = tile[i] * (1.0f / 255.0f);
+        }
+
+        labels[r] = glyph_class(&corpus -> index[samples[r]]);
+    }
+}
+
+static float accuracy(const MLP *m, MLPWork *work, const Corpus *corpus, const uint64_t *samples, uint64_t n, float *x, int *labels)
+{
+    uint64_t right = 0;
+
+    for (uint64_t first = 0; first < n; first += work -> capacity)
+    {
+        int count = (n - first < (uint64_t)work -> capacity) ? (int)(n - first) : work -> capacity;
+
+        gather(corpus, samples + first, count, x, labels);
+        const float *p = mlp_forward(m, work, x, count);
+
+        for (int r = 0; r < count; r++)
+        {
+            right += mlp_argmax(p + (size_t)r * mlp_classes(m), mlp_classes(m)) == labels[r];
+        }
+    }
+
+    return n ? 100.0f * right / n : 0.0f;
+}
+
+static uint64_t labeled_glyphs(const Corpus *corpus, uint64_t *samples)
+{
+    uint64_t n = 0;
+
+    for (uint64_t k = 0; k < corpus -> count; k++)
+    {
+        if (glyph_class(&corpus -> index[k]) >= 0) samples[n++] = k;
+    }
+
+    return n;
+}
+
+// accuracy on every labeled glyph of the corpus in percent, with the float model or its int8 version when q is set.
+// ms : time spent in the network only, the gathering of the tiles left out
+static float evaluate(const MLP *m, const QMLP *q, const Corpus *corpus, double *ms)
+{
+    int capacity = 256;
+    int classes = q ? q -> sizes[q -> layers] : mlp_classes(m);
+
+    uint64_t *samples = malloc((corpus -> count ? corpus -> count : 1) * sizeof(uint64_t));
+    float *x = malloc((size_t)capacity * CORPUS_TILE_BYTES * sizeof(float));
+    float *scores = malloc((size_t)capacity * classes * sizeof(float));
+    int *labels = malloc(capacity * sizeof(int));
+
+    if (!samples || !x || !scores || !labels)
+    {
+        errx(EXIT_FAILURE, "train: out of memory");
+    }
+
+    uint64_t n = labeled_glyphs(corpus, samples), right = 0;
+    MLPWork *work = q ? NULL : mlp_work_create(m, capacity);
+    QMLPWork *qwork = q ? qmlp_work_create(q, capacity) : NULL;
+    Uint64 ticks = 0;
+
+    for (uint64_t first = 0; first < n; first += capacity)
+    {
+        int count = (n - first < (uint64_t)capacity) ? (int)(n - first) : capacity;
+
+        gather(corpus, samples + first, count, x, labels);
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        const float *p = scores;
+
+        if (q) qmlp_forward(q, qwork, x, count, scores);
+        else p = mlp_forward(m, work, x, count);
+
+        ticks += SDL_GetPerformanceCounter() - start;
+
+        for (int r = 0; r < count; r++)
+        {
+            right += mlp_argmax(p + (size_t)r * classes, classes) == labels[r];
+        }
+    }
+
+    if (ms) *ms = (double)ticks * 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+    mlp_work_free(work);
+    qmlp_work_free(qwork);
+    free(samples);
+    free(x);
+    free(scores);
+    free(labels);
+
+    return n ? 100.0f * right / n : 0.0f;
+}
+
+float train_evaluate(const MLP *m, const Corpus *corpus, double *ms)
+{
+    return evaluate(m, NULL, corpus, ms);
+}
+
+float train_evaluate_quantized(const QMLP *q, const Corpus *corpus, double *ms)
+{
+    return evaluate(NULL, q, corpus, ms);
+}
+
+void train_recognize(const MLP *m, const GlyphBatch *glyphs, char *letters)     // the letter of every glyph of the batch, 'A' .. 'Z'
+{
+    int capacity = 256;
+
+    float *x = malloc((size_t)capacity * GLYPH_PIXELS * sizeof(float));
+    MLPWork *work = mlp_work_create(m, capacity);
+
+    if (!x)
+    {
+        errx(EXIT_FAILURE, "train: out of memory");
+    }
+
+    for (int first = 0; first < glyphs -> count; first += capacity)
+    {
+        int count = glyphs -> count - first < capacity ? glyphs -> count - first : capacity;
+
+        glyph_batch_to_float(glyphs, first, count, x);
+        const float *p = mlp_forward(m, work, x, count);
+
+        for (int r = 0; r < count; r++)
+        {
+            letters[first + r] = (char)('A' + mlp_argmax(p + (size_t)r * mlp_classes(m), mlp_classes(m)));
+        }
+    }
+
+    mlp_work_free(work);
+    free(x);
+}
+
+QMLP *train_quantize(const MLP *m, const Corpus *corpus)     // calibrated on the first TRAIN_CALIBRATION labeled glyphs
+{
+    uint64_t *samples = malloc((corpus -> count ? corpus -> count : 1) * sizeof(uint64_t));
+
+    if (!samples)
+    {
+        errx(EXIT_FAILURE, "train: out of memory");
+    }
+
+    uint64_t n = labeled_glyphs(corpus, samples);
+
+    if (n > TRAIN_CALIBRATION) n = TRAIN_CALIBRATION;
+
+    if (n == 0)
+    {
+        errx(EXIT_FAILURE, "train: the corpus has no labeled glyph to calibrate on");
+    }
+
+    float *x = malloc((size_t)n * CORPUS_TILE_BYTES * sizeof(float));
+    int *labels = malloc(n * sizeof(int));
+
+    if (!x || !labels)
+    {
+        errx(EXIT_FAILURE, "train: out of memory");
+    }
+
+    gather(corpus, samples, (int)n, x, labels);
+
+    QMLP *q = qmlp_quantize(m, x, (int)n);
+
+    free(samples);
+    free(x);
+    free(labels);
+
+    return q;
+}
+
+typedef struct {
+    MLPWork *work;
+    float *x;
+    int *labels;
+    int n;              // rows of the current shard
+    float loss;         // mean over them
+} Worker;
+
+typedef struct {
+    MLP *m;
+    const Corpus *corpus;
+    const TrainOptions *options;
+    Worker *workers;
+    int shards;                 // workers, a minibatch smaller than that has one shard per row
+    int chunks;                 // of the gradient, for the reduction
+    const uint64_t *samples;    // the training glyphs of the epoch, shuffled
+    uint64_t count;
+    SDL_mutex *lock;            // barrier between the phases of a minibatch
+    SDL_cond *turn;
+    int arrived;
+    unsigned phase;
+    double loss;                // sum of the minibatch losses of the epoch
+    int steps;
+} TrainJob;
+
+static void barrier(TrainJob *job)     // every worker of the epoch waits until all of them got here
+{
+    SDL_LockMutex(job -> lock);
+
+    unsigned phase = job -> phase;
+
+    if (++job -> arrived == job -> shards)
+    {
+        job -> arrived = 0;
+        job -> phase++;
+        SDL_CondBroadcast(job -> turn);
+    }
+    else
+    {
+        while (phase == job -> phase)
+            SDL_CondWait(job -> turn, job -> lock);
+    }
+
+    SDL_UnlockMutex(job -> lock);
+}
+
+// rows of the minibatch for one worker, its gradient stays in its work
+static void run_shard(TrainJob *job, int index, const uint64_t *samples, uint64_t count, int shards)
+{
+    Worker *worker = &job -> workers[index];
+
+    uint64_t first = count * index / shards;
+    uint64_t last = count * (index + 1) / shards;
+
+    worker -> n = (int)(last - first);
+    worker -> loss = 0.0f;
+
+    if (worker -> n == 0) return;
+
+    gather(job -> corpus, samples + first, worker -> n, worker -> x, worker -> labels);
+    mlp_forward(job -> m, worker -> work, worker -> x, worker -> n);
+
+    worker -> loss = mlp_backward(job -> m, worker -> work, worker -> labels, worker -> n);
+}
+
+// gradient of the minibatch into the first work, shards added in order
+static void reduce_chunk(TrainJob *job, int index, uint64_t count, int shards)
+{
+    size_t from = (size_t)index * TRAIN_REDUCE_CHUNK;
+    size_t to = from + TRAIN_REDUCE_CHUNK < job -> m -> count ? from + TRAIN_REDUCE_CHUNK : job -> m -> count;
+
+    float *sum = job -> workers[0].work -> grad;
+    float w0 = (float)job -> workers[0].n / count;
+
+    for (size_t i = from; i < to; i++) sum[i] *= w0;
+
+    for (int s = 1; s < shards; s++)
+    {
+        const float *grad = job -> workers[s].work -> grad;
+        float ws = (float)job -> workers[s].n / count;
+
+        if (job -> workers[s].n == 0) continue;
+
+        for (size_t i = from; i < to; i++) sum[i] += ws * grad[i];
+    }
+}
+
+// one worker for a whole epoch : its shard of every minibatch, then its chunks of the reduction, then the first
+// worker steps. the workers wait for each other between these, so they must all run at the same time.
+static void run_minibatches(void *ctx, int index)
+{
+    TrainJob *job = ctx;
+    int batch = job -> options -> batch;
+
+    for (uint64_t first = 0; first < job -> count; first += batch)
+    {
+        uint64_t count = (job -> count - first < (uint64_t)batch) ? job -> count - first : (uint64_t)batch;
+        int shards = count < (uint64_t)job -> shards ? (int)count : job -> shards;
+
+        if (index < shards)
+            run_shard(job, index, job -> samples + first, count, shards);
+
+        barrier(job);
+
+        for (int c = index; c < job -> chunks; c += job -> shards)
+            reduce_chunk(job, c, count, shards);
+
+        barrier(job);
+
+        if (index == 0)
+        {
+            mlp_step(job -> m, job -> workers[0].work -> grad, job -> options -> lr);
+
+            for (int s = 0; s < shards; s++) job -> loss += job -> workers[s].loss * job -> workers[s].n / count;
+            job -> steps++;
+        }
+
+        barrier(job);     // the weights are updated before the next forward pass
+    }
+}
+
+static void run_hogwild(void *ctx, int index)     // every shards-th minibatch of the epoch, steps on the shared weights
+{
+    TrainJob *job = ctx;
+    Worker *worker = &job -> workers[index];
+    int batch = job -> options -> batch;
+
+    worker -> n = 0;
+    worker -> loss = 0.0f;
+
+    for (uint64_t first = (uint64_t)index * batch; first < job -> count; first += (uint64_t)job -> shards * batch)
+    {
+        int count = (job -> count - first < (uint64_t)batch) ? (int)(job -> count - first) : batch;
+
+        gather(job -> corpus, job -> samples + first, count, worker -> x, worker -> labels);
+        mlp_forward(job -> m, worker -> work, worker -> x, count);
+
+        worker -> loss += mlp_backward(job -> m, worker -> work, worker -> labels, count);
+        worker -> n++;
+
+        mlp_step(job -> m, worker -> work -> grad, job -> options -> lr);
+    }
+}
+
+MLP *train_corpus(const Corpus *corpus, const TrainOptions *options)
+{
+    uint64_t *train = malloc((corpus -> count ? corpus -> count : 1) * sizeof(uint64_t));
+    uint64_t *check = malloc((corpus -> count ? corpus -> count : 1) * sizeof(uint64_t));
+
+    if (!train || !check)
+    {
+        errx(EXIT_FAILURE, "train: out of memory");
+    }
+
+    uint64_t n_train = 0, n_check = 0, labeled = 0;
+
+    for (uint64_t k = 0; k < corpus -> count; k++)
+    {
+        if (glyph_class(&corpus -> index[k]) < 0) continue;
+
+        if (labeled++ % TRAIN_VALIDATION == TRAIN_VALIDATION - 1) check[n_check++] = k;
+        else train[n_train++] = k;
+    }
+
+    if (n_train == 0)
+    {
+        errx(EXIT_FAILURE, "train: the corpus has no labeled glyph");
+    }
+
+    int sizes[MLP_MAX_LAYERS + 1];
+
+    sizes[0] = CORPUS_TILE_BYTES;
+    for (int l = 0; l < options -> n_hidden; l++) sizes[l + 1] = options -> hidden[l];
+    sizes[options -> n_hidden + 1] = MLP_CLASSES;
+
+    MLP *m = mlp_create(options -> n_hidden + 1, sizes, options -> seed);
+
+    parallel_set_threads(options -> threads);
+
+    int threads = parallel_threads();
+
+    if (!options -> hogwild && threads > options -> batch) threads = options -> batch;     // at least one row per shard
+
+    Worker *workers = calloc(threads, sizeof(Worker));
+
+    if (!workers)
+    {
+        errx(EXIT_FAILURE, "train: out of memory");
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+        workers[t].work = mlp_work_create(m, options -> batch);
+        workers[t].x = malloc((size_t)options -> batch * CORPUS_TILE_BYTES * sizeof(float));
+        workers[t].labels = malloc(options -> batch * sizeof(int));
+
+        if (!workers[t].x || !workers[t].labels)
+        {
+            errx(EXIT_FAILURE, "train: out of memory");
+        }
+    }
+
+    printf("training on %llu glyphs, %llu kept to check, %zu parameters, %d threads%s\n",
+           (unsigned long long)n_train, (unsigned long long)n_check, m -> count, threads, options -> hogwild ? " (hogwild)" : "");
+
+    TrainJob job = { .m = m, .corpus = corpus, .options = options, .workers = workers, .shards = threads,
+                     .chunks = (int)((m -> count + TRAIN_REDUCE_CHUNK - 1) / TRAIN_REDUCE_CHUNK),
+                     .samples = train, .count = n_train, .lock = SDL_CreateMutex(), .turn = SDL_CreateCond() };
+
+    if (!job.lock || !job.turn)
+    {
+        errx(EXIT_FAILURE, "train: %s", SDL_GetError());
+    }
+
+    unsigned state = options -> seed ? options -> seed : 1;
+
+    for (int epoch = 0; epoch < options -> epochs; epoch++)
+    {
+        Uint64 start = SDL_GetPerformanceCounter();
+
+        for (uint64_t i = n_train - 1; i > 0; i--)     // shuffle
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+
+            uint64_t j = state % (i + 1);
+            uint64_t t = train[i]; train[i] = train[j]; train[j] = t;
+        }
+
+        job.loss = 0.0;
+        job.steps = 0;
+
+        parallel_for(threads, options -> hogwild ? run_hogwild : run_minibatches, &job);     // the workers live for the whole epoch
+
+        if (options -> hogwild)
+        {
+            for (int t = 0; t < threads; t++)
+            {
+                job.loss += workers[t].loss;
+                job.steps += workers[t].n;
+            }
+        }
+
+        double seconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+
+        printf("epoch %d : loss %.4f, validation %.1f%%, %.2f s, %.0f samples/s\n",
+               epoch + 1, job.loss / job.steps, accuracy(m, workers[0].work, corpus, check, n_check, workers[0].x, workers[0].labels),
+               seconds, n_train / seconds);
+        fflush(stdout);
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+        mlp_work_free(workers[t].work);
+        free(workers[t].x);
+        free(workers[t].labels);
+    }
+
+    SDL_DestroyMutex(job.lock);
+    SDL_DestroyCond(job.turn);
+    free(workers);
+    free(train);
+    free(check);
+
+    return m;
+}
@@ -0,0 +1,28 @@
+#ifndef TRAIN_H
+#define TRAIN_H
+
+#include "mlp.h"
+#include "quantize.h"
+#include "../corpus/corpus.h"
+
+typedef struct {
+    int epochs;
+    int batch;                          // samples per step
+    float lr;
+    int hidden[MLP_MAX_LAYERS - 1];     // units of the hidden layers
+    int n_hidden;
+    unsigned seed;
+    int threads;                        // 0 : one per cpu
+    int hogwild;                        // threads update the weights without waiting for each other
+    const char *save;                   // model file written after the last epoch, NULL for none
+} TrainOptions;
+
+void train_default_options(TrainOptions *options);
+int train_parse_option(TrainOptions *options, const char *arg);
+MLP *train_corpus(const Corpus *corpus, const TrainOptions *options);
+float train_evaluate(const MLP *m, const Corpus *corpus, double *ms);
+float train_evaluate_quantized(const QMLP *q, const Corpus *corpus, double *ms);
+QMLP *train_quantize(const MLP *m, const Corpus *corpus);
+void train_recognize(const MLP *m, const GlyphBatch *glyphs, char *letters);
+
+#endif
@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <SDL2/SDL.h>
+#include "normalize.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GLYPH_SIMD 1
+#endif
+
+// letters of any size become fixed size glyphs for the recognizer :
+// the centre of mass of the ink goes to the centre of the glyph and the longest side is scaled to GLYPH_FIT,
+// or less when the letter would not fit around its centre of mass.
+// the scaling averages areas : a glyph pixel is the part of its square covered by ink, whether the letter
+// is shrunk or enlarged. it is separable, every letter pixel has a weight for each glyph column (its overlap
+// with the column) and each glyph row, so both passes add whole glyph rows, GLYPH_SIDE floats at a time.
+
+typedef void (*add_row_fn)(float* out, const float* row, float weight);
+typedef void (*sum_rows_fn)(BitView view, float top, float scale, const float* column, float* row, float* rows);
+
+static void add_row_scalar(float* out, const float* row, float weight)    // out += weight * row, GLYPH_SIDE floats
+{
+    for (int i = 0; i < GLYPH_SIDE; i++)
+    {
+        out[i] += weight * row[i];
+    }
+}
+
+#ifdef GLYPH_SIMD
+
+__attribute__((target("sse2")))
+static void add_row_sse2(float* out, const float* row, float weight)
+{
+    __m128 w = _mm_set1_ps(weight);
+
+    for (int i = 0; i < GLYPH_SIDE; i += 4)
+    {
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(w, _mm_loadu_ps(row + i))));
+    }
+}
+
+__attribute__((target("avx2")))
+static void add_row_avx2(float* out, const float* row, float weight)
+{
+    __m256 w = _mm256_set1_ps(weight);
+
+    for (int i = 0; i < GLYPH_SIDE; i += 8)
+    {
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(w, _mm256_loadu_ps(row + i))));
+    }
+}
+
+#endif
+
+// inlined as well : a call out of the avx2 code into plain sse code would pay for the switch
+static inline __attribute__((always_inline)) void overlaps(float from, float to, float* weights)    // overlap of [from, to) with every glyph pixel [i, i + 1)
+{
+    memset(weights, 0, GLYPH_SIDE * sizeof(float));
+
+    int first = (int)floorf(from);
+    int last = (int)ceilf(to);
+
+    if (first < 0) first = 0;
+    if (last > GLYPH_SIDE) last = GLYPH_SIDE;
+
+    for (int i = first; i < last; i++)
+    {
+        float lo = from > (float)i ? from : (float)i;
+        float hi = to < (float)(i + 1) ? to : (float)(i + 1);
+
+        if (hi > lo) weights[i] = hi - lo;
+    }
+}
+
+// every letter row : its ink spread over the glyph columns, then added to the glyph rows it overlaps.
+// inlined once per instruction set with its add_row known, so the adds are inlined as well
+static inline __attribute__((always_inline))
+void sum_rows_with(BitView view, float top, float scale, const float* column, float* row, float* rows, add_row_fn add_row)
+{
+    int words = (view.w + 63) / 64;
+    float weights[GLYPH_SIDE];
+
+    for (int y = 0; y < view.h; y++)
+    {
+        memset(row, 0, GLYPH_SIDE * sizeof(float));
+        int ink = 0;
+
+        for (int k = 0; k < words; k++)
+        {
+            uint64_t word = bit_view_word(view, y, k);
+
+            while (word)
+            {
+                add_row(row, column + (size_t)(k * 64 + __builtin_ctzll(word)) * GLYPH_SIDE, 1.0f);
+                ink = 1;
+
+                word &= word - 1;
+            }
+        }
+
+        if (!ink) continue;
+
+        overlaps(top + y * scale, top + (y + 1) * scale, weights);
+
+        for (int i = 0; i < GLYPH_SIDE; i++)
+        {
+            if (weights[i] > 0.0f) add_row(rows + i * GLYPH_SIDE, row, weights[i]);
+        }
+    }
+}
+
+static void sum_rows_scalar(BitView view, float top, float scale, const float* column, float* row, float* rows)
+{
+    sum_rows_with(view, top, scale, column, row, rows, add_row_scalar);
+}
+
+#ifdef GLYPH_SIMD
+
+__attribute__((target("sse2")))
+static void sum_rows_sse2(BitView view, float top, float scale, const float* column, float* row, float* rows)
+{
+    sum_rows_with(view, top, scale, column, row, rows, add_row_sse2);
+}
+
+__attribute__((target("avx2")))
+static void sum_rows_avx2(BitView view, float top, float scale, const float* column, float* row, float* rows)
+{
+    sum_rows_with(view, top, scale, column, row, rows, add_row_avx2);
+}
+
+#endif
+
+static sum_rows_fn pick_sum_rows(void)  // chosen at runtime so one binary runs everywhere
+{
+#ifdef GLYPH_SIMD
+    if (SDL_HasAVX2()) return sum_rows_avx2;
+    if (SDL_HasSSE2()) return sum_rows_sse2;
+#endif
+    return sum_rows_scalar;
+}
+
+void glyph_mass_centre(BitView view, float* cx, float* cy)     // mean position of the ink, in pixels of the view
+{
+    int words = (view.w + 63) / 64;
+
+    double sx = 0.0, sy = 0.0;
+    long area = 0;
+
+    for (int y = 0; y < view.h; y++)
+    {
+        for (int k = 0; k < words; k++)
+        {
+            uint64_t word = bit_view_word(view, y, k);
+
+            while (word)
+            {
+                sx += k * 64 + __builtin_ctzll(word);
+                sy += y;
+                area++;
+
+                word &= word - 1;
+            }
+        }
+    }
+
+    *cx = area ? (float)(sx / area) : (view.w - 1) / 2.0f;
+    *cy = area ? (float)(sy / area) : (view.h - 1) / 2.0f;
+}
+
+// cx, cy : centre of mass in pixels of the view, scratch : GLYPH_SCRATCH(view.w) floats
+void glyph_normalize(BitView view, float cx, float cy, uint8_t* tile, float* scratch)
+{
+    memset(tile, 0, GLYPH_PIXELS);
+
+    if (view.w <= 0 || view.h <= 0)
+        return;
+
+    float scale = (float)GLYPH_FIT / (float)(view.w > view.h ? view.w : view.h);     // glyph pixels per letter pixel
+    float reach = fmaxf(fmaxf(cx + 0.5f, view.w - cx - 0.5f), fmaxf(cy + 0.5f, view.h - cy - 0.5f));     // farthest edge from the centre
+
+    if (reach * scale > GLYPH_SIDE / 2.0f)     // a letter with its mass off centre is made smaller instead of cut
+        scale = GLYPH_SIDE / 2.0f / reach;
+
+    float left = GLYPH_SIDE / 2.0f - (cx + 0.5f) * scale;      // glyph position of the letter left edge
+    float top = GLYPH_SIDE / 2.0f - (cy + 0.5f) * scale;
+
+    float* rows = scratch;                      // the glyph being summed
+    float* column = rows + GLYPH_PIXELS;        // weights of every letter column, then one spare row
+    float* row = column + (size_t)view.w * GLYPH_SIDE;     // the letter row spread over the glyph columns
+
+    memset(rows, 0, GLYPH_PIXELS * sizeof(float));
+
+    for (int x = 0; x < view.w; x++)
+    {
+        overlaps(left + x * scale, left + (x + 1) * scale, column + (size_t)x * GLYPH_SIDE);
+    }
+
+    pick_sum_rows()(view, top, scale, column, row, rows);
+
+    for (int i = 0; i < GLYPH_PIXELS; i++)
+    {
+        float v = rows[i] * 255.0f + 0.5f;
+        tile[i] = v >= 255.0f ? 255 : (uint8_t)v;
+    }
+}
+
+GlyphBatch* glyph_batch_create(void)
+{
+    GlyphBatch* batch = calloc(1, sizeof(GlyphBatch));
+
+    if (!batch)
+    {
+        errx(EXIT_FAILURE, "glyph_batch_create: out of memory");
+    }
+
+    return batch;
+}
+
+uint8_t* glyph_batch_add(GlyphBatch* batch, int i, int j)     // room for one more glyph at the end of the batch
+{
+    if (batch -> count == batch -> capacity)
+    {
+        int capacity = batch -> capacity ? batch -> capacity * 2 : 256;
+        uint8_t* tiles = SDL_SIMDAlloc((size_t)capacity * GLYPH_PIXELS);
+        int* is = realloc(batch -> i, capacity * sizeof(int));
+        int* js = is ? realloc(batch -> j, capacity * sizeof(int)) : NULL;
+
+        if (!tiles || !is || !js)
+        {
+            errx(EXIT_FAILURE, "glyph_batch_add: out of memory");
+        }
+
+        batch -> i = is;
+        batch -> j = js;
+
+        if (batch -> count)
+            memcpy(tiles, batch -> tiles, (size_t)batch -> count * GLYPH_PIXELS);
+
+        SDL_SIMDFree(batch -> tiles);
+
+        batch -> tiles = tiles;
+        batch -> capacity = capacity;
+    }
+
+    batch -> i[batch -> count] = i;
+    batch -> j[batch -> count] = j;
+
+    return batch -> tiles + (size_t)batch -> count++ * GLYPH_PIXELS;
+}
+
+void glyph_batch_to_float(const GlyphBatch* batch, int first, int count, float* out)    // glyphs first .. first + count - 1 as 0 .. 1 inputs
+{
+    const uint8_t* in = glyph_batch_tile(batch, first);
+    size_t n = (size_t)count * GLYPH_PIXELS;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        out[i] = in[i] * (1.0f / 255.0f);
+    }
+}
+
+void glyph_batch_free(GlyphBatch* batch)
+{
+    if (!batch)
+        return;
+
+    SDL_SIMDFree(batch -> tiles);
+    free(batch -> i);
+    free(batch -> j);
+    free(batch);
+}
@@ -0,0 +1,31 @@
+#ifndef NORMALIZE_H
+#define NORMALIZE_H
+
+#include <stdint.h>
+#include "../image/image.h"
+
+#define GLYPH_SIDE 32           // glyphs are GLYPH_SIDE x GLYPH_SIDE, 0 = paper, 255 = ink
+#define GLYPH_PIXELS (GLYPH_SIDE * GLYPH_SIDE)
+#define GLYPH_FIT 28            // the longest side of the letter is scaled to this
+#define GLYPH_SCRATCH(w) (((size_t)(w) + 1 + GLYPH_SIDE) * GLYPH_SIDE)     // floats glyph_normalize needs for a letter w pixels wide
+
+typedef struct {
+    int count, capacity;
+    uint8_t* tiles;             // count x GLYPH_PIXELS, one after the other, SIMD aligned
+    int *i, *j;                 // place of every glyph, grid row and column or word and letter
+} GlyphBatch;
+
+void glyph_mass_centre(BitView view, float* cx, float* cy);
+void glyph_normalize(BitView view, float cx, float cy, uint8_t* tile, float* scratch);
+
+GlyphBatch* glyph_batch_create(void);
+uint8_t* glyph_batch_add(GlyphBatch* batch, int i, int j);
+void glyph_batch_to_float(const GlyphBatch* batch, int first, int count, float* out);
+void glyph_batch_free(GlyphBatch* batch);
+
+static inline const uint8_t* glyph_batch_tile(const GlyphBatch* batch, int k)
+{
+    return batch -> tiles + (size_t)k * GLYPH_PIXELS;
+}
+
+#endif
@@ -0,0 +1,170 @@
+// libraries
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+// headers
+#include "parallel.h"
+
+// the workers are created the first time they are needed and then wait for the next job, a call only wakes them.
+// a job is handed out with a generation number : every sleeping worker wakes up, the first ones join it
+// until it has as many as it wants and the others go back to sleep. the pool grows when more threads are asked for,
+// the workers live as long as the process. a call made while the pool is busy (a task that calls parallel_for,
+// or another thread) runs its tasks itself.
+
+#define PARALLEL_MAX_THREADS 64
+
+static int thread_count = 0;   // 0 = one per cpu
+
+typedef struct {
+    parallel_fn fn;
+    void *ctx;
+    int count;
+    SDL_atomic_t next;          // next task index to hand out
+} ParallelJob;
+
+typedef struct {
+    SDL_mutex *lock;
+    SDL_cond *wake;             // a new job or more workers wanted
+    SDL_cond *done;             // the last worker of the job left it
+    int workers;                // threads started, the calling thread not counted
+    ParallelJob *job;
+    unsigned generation;        // number of the current job
+    int wanted;                 // workers the job asks for
+    int joined;
+    int finished;
+} ParallelPool;
+
+static ParallelPool pool = {0};
+static SDL_atomic_t busy = {0};    // 1 while a job runs on the pool
+
+void parallel_set_threads(int threads)
+{
+    thread_count = threads;
+}
+
+int parallel_threads(void)
+{
+    int threads = thread_count > 0 ? thread_count : SDL_GetCPUCount();
+
+    if (threads < 1) threads = 1;
+    if (threads > PARALLEL_MAX_THREADS) threads = PARALLEL_MAX_THREADS;
+
+    return threads;
+}
+
+static void run_tasks(ParallelJob *job)
+{
+    int index;
+
+    while ((index = SDL_AtomicAdd(&job -> next, 1)) < job -> count)
+    {
+        job -> fn(job -> ctx, index);
+    }
+}
+
+static int parallel_worker(void *data)
+{
+    unsigned seen = (unsigned)(uintptr_t)data;     // generation when it was created, the job that wanted it is the next one
+
+    SDL_LockMutex(pool.lock);
+
+    while (1)
+    {
+        while (pool.generation == seen)
+            SDL_CondWait(pool.wake, pool.lock);
+
+        seen = pool.generation;
+
+        if (pool.joined == pool.wanted)     // the job has enough workers
+            continue;
+
+        pool.joined++;
+        ParallelJob *job = pool.job;
+
+        SDL_UnlockMutex(pool.lock);
+        run_tasks(job);
+        SDL_LockMutex(pool.lock);
+
+        if (++pool.finished == pool.wanted)
+            SDL_CondSignal(pool.done);
+    }
+
+    return 0;
+}
+
+static void pool_create(void)     // only one thread gets past busy, no other can be here
+{
+    pool.lock = SDL_CreateMutex();
+    pool.wake = SDL_CreateCond();
+    pool.done = SDL_CreateCond();
+
+    if (!pool.lock || !pool.wake || !pool.done)
+    {
+        errx(EXIT_FAILURE, "parallel_for: %s", SDL_GetError());
+    }
+}
+
+static void pool_grow(int workers)     // lock held
+{
+    for (; pool.workers < workers; pool.workers++)
+    {
+        SDL_Thread *thread = SDL_CreateThread(parallel_worker, "worker", (void *)(uintptr_t)pool.generation);
+
+        if (!thread)
+        {
+            errx(EXIT_FAILURE, "parallel_for: %s", SDL_GetError());
+        }
+
+        SDL_DetachThread(thread);
+    }
+}
+
+// runs fn(ctx, 0 .. count - 1), tasks are taken in order by the workers.
+// with count <= parallel_threads(), outside of another parallel_for, every task gets its own thread and they all run
+// at the same time, so tasks may wait for each other.
+void parallel_for(int count, parallel_fn fn, void *ctx)
+{
+    int threads = parallel_threads();
+
+    if (threads > count) threads = count;
+
+    if (threads <= 1 || !SDL_AtomicCAS(&busy, 0, 1))
+    {
+        for (int i = 0; i < count; i++)
+        {
+            fn(ctx, i);
+        }
+
+        return;
+    }
+
+    ParallelJob job = { fn, ctx, count, {0} };
+
+    if (!pool.lock)
+        pool_create();
+
+    SDL_LockMutex(pool.lock);
+    pool_grow(threads - 1);
+
+    pool.job = &job;
+    pool.wanted = threads - 1;
+    pool.joined = 0;
+    pool.finished = 0;
+    pool.generation++;
+
+    SDL_CondBroadcast(pool.wake);
+    SDL_UnlockMutex(pool.lock);
+
+    run_tasks(&job);  // the calling thread works too
+
+    SDL_LockMutex(pool.lock);
+
+    while (pool.finished < pool.wanted)
+        SDL_CondWait(pool.done, pool.lock);
+
+    SDL_UnlockMutex(pool.lock);
+    SDL_AtomicSet(&busy, 0);
+}
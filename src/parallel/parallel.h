@@ -0,0 +1,10 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+typedef void (*parallel_fn)(void *ctx, int index);
+
+void parallel_set_threads(int threads);
+int parallel_threads(void);
+void parallel_for(int count, parallel_fn fn, void *ctx);
+
+#endif
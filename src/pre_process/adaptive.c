@@ -0,0 +1,340 @@
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <SDL2/SDL.h>
+#include "pre_process.h"
+#include "../parallel/parallel.h"
+#include "../arena/arena.h"
+
+// adaptive binarization : every pixel gets its own threshold from the mean and the standard deviation
+// of the window around it (sauvola or niblack), so shadows and uneven lighting do not swallow letters.
+// sauvola is normalized by the contrast of the image (darkest gray and largest deviation, as Wolf does)
+// instead of fixed 0 .. 128 ranges, otherwise light gray letters on a bright page vanish.
+// both come from summed area tables of the value and of its square : four lookups per table
+// whatever the window size. the tables are summed modulo 2^32, a window difference stays exact
+// as long as the window sum itself fits, which BINARIZE_MAX_WINDOW guarantees.
+
+#define SAUVOLA_K 0.34f
+#define NIBLACK_K -0.2f
+
+#define BINARIZE_BAND 32     // rows per parallel task
+#define BINARIZE_STRIP 256   // table columns per parallel task of the vertical pass
+#define BINARIZE_ARENA (4 << 20)
+
+static Arena* tables = NULL;     // summed area tables and column sums, kept from one image to the next
+
+static BinarizeMethod binarize_method_used = BINARIZE_OTSU;
+static int binarize_window = 41;
+
+int binarize_set_method(const char *name)    // 0 if the name is unknown
+{
+    if (strcmp(name, "otsu") == 0) binarize_method_used = BINARIZE_OTSU;
+    else if (strcmp(name, "sauvola") == 0) binarize_method_used = BINARIZE_SAUVOLA;
+    else if (strcmp(name, "niblack") == 0) binarize_method_used = BINARIZE_NIBLACK;
+    else return 0;
+
+    return 1;
+}
+
+BinarizeMethod binarize_method(void)
+{
+    return binarize_method_used;
+}
+
+const char* binarize_method_name(void)
+{
+    switch (binarize_method_used)
+    {
+        case BINARIZE_SAUVOLA: return "sauvola";
+        case BINARIZE_NIBLACK: return "niblack";
+        default: return "otsu";
+    }
+}
+
+void binarize_set_window(int size)
+{
+    if (size < 3 || size % 2 == 0 || size > BINARIZE_MAX_WINDOW)
+    {
+        errx(EXIT_FAILURE, "binarize: window size must be odd, between 3 and %d (got %d)", BINARIZE_MAX_WINDOW, size);
+    }
+
+    binarize_window = size;
+}
+
+typedef struct {
+    const GrayImage* image;
+    BitImage* bits;
+    Uint32* sum;        // (w + 1) x (h + 1), first row and column are 0
+    Uint32* square;
+    int pitch;          // w + 1
+    int r;              // half window
+    uint8_t* band_min;      // darkest gray of each band
+    float* band_deviation;  // largest variance of each band
+    float darkest;
+    float range;            // largest deviation of the image
+    Uint32* columns;        // two rows of column sums per band
+} AdaptiveJob;
+
+static void prefix_rows(void* ctx, int index)    // horizontal running sums of a band of rows
+{
+    AdaptiveJob* job = ctx;
+
+    int w = job -> image -> w;
+    int y0 = index * BINARIZE_BAND;
+    int y1 = (y0 + BINARIZE_BAND < job -> image -> h) ? y0 + BINARIZE_BAND : job -> image -> h;
+
+    uint8_t darkest = 255;
+
+    for (int y = y0; y < y1; y++)
+    {
+        const uint8_t* row = job -> image -> pixels + (size_t)y * job -> image -> stride;
+        Uint32* sum = job -> sum + (size_t)(y + 1) * job -> pitch;
+        Uint32* square = job -> square + (size_t)(y + 1) * job -> pitch;
+
+        Uint32 s = 0, q = 0;
+        sum[0] = square[0] = 0;
+
+        for (int x = 0; x < w; x++)
+        {
+            if (row[x] < darkest) darkest = row[x];
+
+            s += row[x];
+            q += (Uint32)row[x] * row[x];
+
+            sum[x + 1] = s;
+            square[x + 1] = q;
+        }
+    }
+
+    job -> band_min[index] = darkest;
+}
+
+static void prefix_columns(void* ctx, int index)    // vertical running sums of a strip of columns, row after row so reads stay contiguous
+{
+    AdaptiveJob* job = ctx;
+
+    int x0 = index * BINARIZE_STRIP;
+    int x1 = (x0 + BINARIZE_STRIP < job -> pitch) ? x0 + BINARIZE_STRIP : job -> pitch;
+
+    for (int y = 2; y <= job -> image -> h; y++)
+    {
+        Uint32* sum = job -> sum + (size_t)y * job -> pitch;
+        Uint32* square = job -> square + (size_t)y * job -> pitch;
+
+        for (int x = x0; x < x1; x++)
+        {
+            sum[x] += sum[x - job -> pitch];
+            square[x] += square[x - job -> pitch];
+        }
+    }
+}
+
+static void window_columns(const AdaptiveJob* job, int y, Uint32* cs, Uint32* cq)    // column sums of the window rows around y
+{
+    int top = (y - job -> r < 0) ? 0 : y - job -> r;
+    int bottom = (y + job -> r + 1 > job -> image -> h) ? job -> image -> h : y + job -> r + 1;
+
+    const Uint32* s0 = job -> sum + (size_t)top * job -> pitch;
+    const Uint32* s1 = job -> sum + (size_t)bottom * job -> pitch;
+    const Uint32* q0 = job -> square + (size_t)top * job -> pitch;
+    const Uint32* q1 = job -> square + (size_t)bottom * job -> pitch;
+
+    for (int x = 0; x < job -> pitch; x++)    // exact modulo 2^32
+    {
+        cs[x] = s1[x] - s0[x];
+        cq[x] = q1[x] - q0[x];
+    }
+}
+
+static inline int window_height(const AdaptiveJob* job, int y)
+{
+    int top = (y - job -> r < 0) ? 0 : y - job -> r;
+    int bottom = (y + job -> r + 1 > job -> image -> h) ? job -> image -> h : y + job -> r + 1;
+
+    return bottom - top;
+}
+
+typedef struct {
+    Uint32* cs;
+    Uint32* cq;
+} ColumnSums;
+
+static void column_sums_of(const AdaptiveJob* job, int band, ColumnSums* sums)
+{
+    sums -> cs = job -> columns + (size_t)band * 2 * job -> pitch;
+    sums -> cq = sums -> cs + job -> pitch;
+}
+
+static void deviation_rows(void* ctx, int index)     // largest variance of a band, for sauvola
+{
+    AdaptiveJob* job = ctx;
+
+    int w = job -> image -> w;
+    int r = job -> r;
+    int y0 = index * BINARIZE_BAND;
+    int y1 = (y0 + BINARIZE_BAND < job -> image -> h) ? y0 + BINARIZE_BAND : job -> image -> h;
+
+    ColumnSums sums;
+    column_sums_of(job, index, &sums);
+
+    float largest = 0.0f;
+
+    for (int y = y0; y < y1; y++)
+    {
+        window_columns(job, y, sums.cs, sums.cq);
+        int height = window_height(job, y);
+
+        for (int x = 0; x < w; x++)
+        {
+            int left = (x - r < 0) ? 0 : x - r;
+            int right = (x + r + 1 > w) ? w : x + r + 1;
+
+            float inv = 1.0f / (float)((right - left) * height);
+            float mean = (float)(sums.cs[right] - sums.cs[left]) * inv;
+            float variance = (float)(sums.cq[right] - sums.cq[left]) * inv - mean * mean;
+
+            if (variance > largest) largest = variance;
+        }
+    }
+
+    job -> band_deviation[index] = largest;
+}
+
+// the thresholds are compared squared so no square root is taken per pixel :
+// niblack   v <= m + k s                          with k < 0  <=>  m - v >= 0 and (m - v)^2 >= k^2 s^2
+// sauvola   v <= m - K (1 - s / R) (m - darkest)              <=>  a <= b s, a = v - m + K (m - darkest), b = K (m - darkest) / R >= 0
+typedef struct {
+    int niblack;
+    float k2;
+    float darkest;
+    float scale;        // K / R
+} Threshold;
+
+static inline uint64_t pixel_ink(const Threshold* t, Uint32 s, Uint32 q, float inv, uint8_t value)   // branchless, bit set for ink
+{
+    float mean = (float)s * inv;
+    float variance = (float)q * inv - mean * mean;
+    float v = (float)value;
+
+    if (t -> niblack)
+    {
+        float a = mean - v;
+        return (a >= 0.0f) & (a * a >= t -> k2 * variance);
+    }
+
+    float a = v - mean + SAUVOLA_K * (mean - t -> darkest);
+    float b = t -> scale * (mean - t -> darkest);
+
+    return (a <= 0.0f) | (a * a <= b * b * variance);
+}
+
+static void threshold_rows(void* ctx, int index)
+{
+    AdaptiveJob* job = ctx;
+
+    int w = job -> image -> w;
+    int r = job -> r;
+    int y0 = index * BINARIZE_BAND;
+    int y1 = (y0 + BINARIZE_BAND < job -> image -> h) ? y0 + BINARIZE_BAND : job -> image -> h;
+
+    Threshold t = { binarize_method_used == BINARIZE_NIBLACK, NIBLACK_K * NIBLACK_K, job -> darkest, SAUVOLA_K / job -> range };
+
+    int inner0 = (r < w) ? r : w;                       // windows of x in inner0 .. inner1 - 1 are not clipped sideways
+    int inner1 = (w - r - 1 > inner0) ? w - r - 1 : inner0;
+
+    ColumnSums sums;
+    column_sums_of(job, index, &sums);
+
+    for (int y = y0; y < y1; y++)
+    {
+        const uint8_t* row = job -> image -> pixels + (size_t)y * job -> image -> stride;
+        uint64_t* out = bit_row(job -> bits, y);
+
+        window_columns(job, y, sums.cs, sums.cq);
+        int height = window_height(job, y);
+
+        const Uint32* cs = sums.cs;
+        const Uint32* cq = sums.cq;
+
+        for (int x = 0; x < w; x++)
+        {
+            if (x == inner0)    // same window size up to inner1
+            {
+                float inv = 1.0f / (float)((2 * r + 1) * height);
+
+                for (; x < inner1; x++)
+                {
+                    out[x >> 6] |= pixel_ink(&t, cs[x + r + 1] - cs[x - r], cq[x + r + 1] - cq[x - r], inv, row[x]) << (x & 63);
+                }
+
+                if (x == w) break;
+            }
+
+            int left = (x - r < 0) ? 0 : x - r;
+            int right = (x + r + 1 > w) ? w : x + r + 1;
+
+            float inv = 1.0f / (float)((right - left) * height);
+
+            out[x >> 6] |= pixel_ink(&t, cs[right] - cs[left], cq[right] - cq[left], inv, row[x]) << (x & 63);
+        }
+    }
+}
+
+BitImage* binarize_adaptive(const GrayImage *image)
+{
+    int w = image -> w;
+    int h = image -> h;
+
+    AdaptiveJob job;
+    job.image = image;
+    job.bits = bit_create(w, h);
+    job.pitch = w + 1;
+    job.r = binarize_window / 2;
+
+    if (!tables)
+        tables = arena_create(BINARIZE_ARENA);
+
+    arena_reset(tables);
+
+    int bands = (h + BINARIZE_BAND - 1) / BINARIZE_BAND;
+
+    job.sum = arena_alloc(tables, (size_t)job.pitch * (h + 1) * sizeof(Uint32));
+    job.square = arena_alloc(tables, (size_t)job.pitch * (h + 1) * sizeof(Uint32));
+    job.band_min = arena_alloc(tables, (size_t)bands + 1);
+    job.band_deviation = arena_alloc(tables, ((size_t)bands + 1) * sizeof(float));
+    job.columns = arena_alloc(tables, (size_t)bands * 2 * job.pitch * sizeof(Uint32));
+
+    memset(job.sum, 0, (size_t)job.pitch * sizeof(Uint32));
+    memset(job.square, 0, (size_t)job.pitch * sizeof(Uint32));
+
+    parallel_for(bands, prefix_rows, &job);
+    parallel_for((job.pitch + BINARIZE_STRIP - 1) / BINARIZE_STRIP, prefix_columns, &job);
+
+    job.darkest = 255.0f;
+    job.range = 1.0f;
+
+    for (int i = 0; i < bands; i++)
+    {
+        if (job.band_min[i] < job.darkest) job.darkest = job.band_min[i];
+    }
+
+    if (binarize_method_used == BINARIZE_SAUVOLA)
+    {
+        parallel_for(bands, deviation_rows, &job);
+
+        float largest = 0.0f;
+
+        for (int i = 0; i < bands; i++)
+        {
+            if (job.band_deviation[i] > largest) largest = job.band_deviation[i];
+        }
+
+        if (largest > 1.0f) job.range = sqrtf(largest);
+    }
+
+    parallel_for(bands, threshold_rows, &job);
+
+    return job.bits;
+}
@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include "pre_process.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// median filter engine used by denoise
+// white pixels and pixels that are part of a horizontal or vertical line are kept as is,
+// every other pixel is replaced by the median of its size x size neighborhood.
+// only the last size rows of the original image are kept, in a small ring.
+
+#define MIN8(a, b) ((a) < (b) ? (a) : (b))
+#define MAX8(a, b) ((a) > (b) ? (a) : (b))
+
+static inline uint8_t med3(uint8_t a, uint8_t b, uint8_t c)
+{
+    return MAX8(MIN8(a, b), MIN8(MAX8(a, b), c));
+}
+
+static inline int keep_pixel(const uint8_t *above, const uint8_t *mid, const uint8_t *below, int x)
+{
+    if (mid[x] == 255) return 1;                                // white
+    if (mid[x - 1] != 255 && mid[x + 1] != 255) return 1;       // horizontal line
+    if (above[x] != 255 && below[x] != 255) return 1;           // vertical line
+
+    return 0;
+}
+
+// median of 9 = median(max of column minimums, median of column medians, min of column maximums)
+static void median3_row_scalar(const uint8_t *above, const uint8_t *mid, const uint8_t *below, uint8_t *out, int x0, int x1)
+{
+    for (int x = x0; x < x1; x++)
+    {
+        uint8_t lo[3], md[3], hi[3];
+
+        for (int i = 0; i < 3; i++)
+        {
+            uint8_t a = above[x - 1 + i], b = mid[x - 1 + i], c = below[x - 1 + i];
+            uint8_t mn = MIN8(a, b), mx = MAX8(a, b);
+
+            lo[i] = MIN8(mn, c);
+            hi[i] = MAX8(mx, c);
+            md[i] = MAX8(mn, MIN8(mx, c));
+        }
+
+        if (keep_pixel(above, mid, below, x)) continue;
+
+        out[x] = med3(MAX8(MAX8(lo[0], lo[1]), lo[2]), med3(md[0], md[1], md[2]), MIN8(MIN8(hi[0], hi[1]), hi[2]));
+    }
+}
+
+#ifdef __SSE2__
+
+static inline __m128i med3_epu8(__m128i a, __m128i b, __m128i c)
+{
+    return _mm_max_epu8(_mm_min_epu8(a, b), _mm_min_epu8(_mm_max_epu8(a, b), c));
+}
+
+static void median3_row(const uint8_t *above, const uint8_t *mid, const uint8_t *below, uint8_t *out, int x0, int x1)
+{
+    __m128i white = _mm_set1_epi8((char)255);
+
+    int x = x0;
+
+    for (; x + 16 <= x1; x += 16)   // 16 pixels at once, then the same keep rules as a mask
+    {
+        __m128i lo[3], md[3], hi[3];
+
+        for (int i = 0; i < 3; i++)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(above + x - 1 + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(mid + x - 1 + i));
+            __m128i c = _mm_loadu_si128((const __m128i *)(below + x - 1 + i));
+
+            __m128i mn = _mm_min_epu8(a, b), mx = _mm_max_epu8(a, b);
+
+            lo[i] = _mm_min_epu8(mn, c);
+            hi[i] = _mm_max_epu8(mx, c);
+            md[i] = _mm_max_epu8(mn, _mm_min_epu8(mx, c));
+        }
+
+        __m128i median = med3_epu8(_mm_max_epu8(_mm_max_epu8(lo[0], lo[1]), lo[2]),
+                                   med3_epu8(md[0], md[1], md[2]),
+                                   _mm_min_epu8(_mm_min_epu8(hi[0], hi[1]), hi[2]));
+
+        __m128i center = _mm_loadu_si128((const __m128i *)(mid + x));
+        __m128i left = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(mid + x - 1)), white);
+        __m128i right = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(mid + x + 1)), white);
+        __m128i up = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(above + x)), white);
+        __m128i down = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(below + x)), white);
+
+        __m128i line = _mm_or_si128(_mm_andnot_si128(_mm_or_si128(left, right), white),
+                                    _mm_andnot_si128(_mm_or_si128(up, down), white));
+        __m128i keep = _mm_or_si128(_mm_cmpeq_epi8(center, white), line);
+
+        _mm_storeu_si128((__m128i *)(out + x), _mm_or_si128(_mm_and_si128(keep, center), _mm_andnot_si128(keep, median)));
+    }
+
+    median3_row_scalar(above, mid, below, out, x, x1);
+}
+
+#else
+
+static void median3_row(const uint8_t *above, const uint8_t *mid, const uint8_t *below, uint8_t *out, int x0, int x1)
+{
+    median3_row_scalar(above, mid, below, out, x0, x1);
+}
+
+#endif
+
+// running histogram median (Huang) : sliding right only removes a column and adds a column,
+// so the cost per pixel grows with size and not with size * size
+static void median_row_hist(const uint8_t **rows, int size, uint8_t *out, int w)
+{
+    int r = size / 2;
+    int half = size * size / 2;     // index of the median in the sorted window
+
+    int hist[256] = {0};
+
+    for (int j = 0; j < size; j++)
+    {
+        for (int i = 0; i < size; i++)
+        {
+            hist[rows[j][i]]++;
+        }
+    }
+
+    int med = 0;
+    int lt = 0;                     // number of values strictly below med
+
+    while (lt + hist[med] <= half)
+    {
+        lt += hist[med];
+        med++;
+    }
+
+    const uint8_t *above = rows[r - 1];
+    const uint8_t *mid = rows[r];
+    const uint8_t *below = rows[r + 1];
+
+    for (int x = r; x < w - r; x++)
+    {
+        if (x > r)
+        {
+            for (int j = 0; j < size; j++)
+            {
+                uint8_t old_v = rows[j][x - r - 1];
+                uint8_t new_v = rows[j][x + r];
+
+                if (old_v == new_v) continue;     // nothing changes, the usual case on white paper
+
+                hist[old_v]--;
+                hist[new_v]++;
+
+                lt += (new_v < med) - (old_v < med);
+            }
+        }
+
+        if (keep_pixel(above, mid, below, x)) continue;
+
+        while (lt > half)           // med is only moved when a median is needed
+        {
+            med--;
+            lt -= hist[med];
+        }
+
+        while (lt + hist[med] <= half)
+        {
+            lt += hist[med];
+            med++;
+        }
+
+        out[x] = (uint8_t)med;
+    }
+}
+
+void median_check_size(int size)
+{
+    if (size < 3 || size % 2 == 0 || size > MEDIAN_MAX_SIZE)
+    {
+        errx(EXIT_FAILURE, "denoise: kernel size must be odd, between 3 and %d (got %d)", MEDIAN_MAX_SIZE, size);
+    }
+}
+
+void denoise_row(const uint8_t **rows, int size, uint8_t *out, int w)  // rows are the size original rows centered on out
+{
+    if (size == 3)
+        median3_row(rows[0], rows[1], rows[2], out, 1, w - 1);
+    else
+        median_row_hist(rows, size, out, w);
+}
+
+void denoise_kernel(GrayImage *image, int size)
+{
+    median_check_size(size);
+
+    int w = image -> w;
+    int h = image -> h;
+    int r = size / 2;
+
+    if (w < size || h < size) return;     // no pixel has a full neighborhood
+
+    int stride = image -> stride;
+    uint8_t *pixels = image -> pixels;
+
+    uint8_t *ring = malloc((size_t)stride * size);     // original rows y - r .. y + r
+    const uint8_t *rows[MEDIAN_MAX_SIZE];
+
+    if (!ring)
+    {
+        errx(EXIT_FAILURE, "denoise: out of memory");
+    }
+
+    for (int j = 0; j < size; j++)
+    {
+        memcpy(ring + (size_t)j * stride, pixels + (size_t)j * stride, w);
+    }
+
+    for (int y = r; y < h - r; y++)
+    {
+        for (int j = 0; j < size; j++)
+        {
+            rows[j] = ring + (size_t)((y - r + j) % size) * stride;
+        }
+
+        uint8_t *out = pixels + (size_t)y * stride;
+
+        denoise_row(rows, size, out, w);
+
+        if (y + r + 1 < h)      // the oldest row is not needed anymore, still untouched row y + r + 1 takes its place
+        {
+            memcpy(ring + (size_t)((y + r + 1) % size) * stride, pixels + (size_t)(y + r + 1) * stride, w);
+        }
+    }
+
+    free(ring);
+}
@@ -4,9 +4,133 @@
 #include <SDL2/SDL.h>
 #include "pre_process.h"
 
-void to_gray_scale(SDL_Surface *surface, int *hist)
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GRAY_SIMD 1
+#endif
+
+// fixed point luma, 0.299 r + 0.587 g + 0.114 b scaled by 2^15
+// the weights add up to exactly 2^15 so a gray pixel keeps its value
+#define LUMA_R 9798
+#define LUMA_G 19235
+#define LUMA_B 3735
+#define LUMA_SHIFT 15
+
+typedef void (*gray_row_fn)(const Uint32 *src, uint8_t *dst, int w);
+
+static void gray_row_scalar(const Uint32 *src, uint8_t *dst, int w)   // RGBA8888 : r is the high byte
+{
+    for (int x = 0; x < w; x++)
+    {
+        Uint32 p = src[x];
+        dst[x] = (uint8_t)(((p >> 24) * LUMA_R + ((p >> 16) & 0xFF) * LUMA_G + ((p >> 8) & 0xFF) * LUMA_B) >> LUMA_SHIFT);
+    }
+}
+
+#ifdef GRAY_SIMD
+
+// each 32 bit lane holds (g << 16 | r) and b, so one madd per pair gives r * LUMA_R + g * LUMA_G
+static inline __m128i luma4_sse2(__m128i p, __m128i crg, __m128i cb, __m128i mask_g, __m128i mask_b)
+{
+    __m128i rg = _mm_or_si128(_mm_srli_epi32(p, 24), _mm_and_si128(p, mask_g));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(p, 8), mask_b);
+
+    __m128i sum = _mm_add_epi32(_mm_madd_epi16(rg, crg), _mm_madd_epi16(b, cb));
+
+    return _mm_srli_epi32(sum, LUMA_SHIFT);
+}
+
+__attribute__((target("sse2")))
+static void gray_row_sse2(const Uint32 *src, uint8_t *dst, int w)
+{
+    __m128i crg = _mm_set1_epi32((LUMA_G << 16) | LUMA_R);
+    __m128i cb = _mm_set1_epi32(LUMA_B);
+    __m128i mask_g = _mm_set1_epi32(0x00FF0000);
+    __m128i mask_b = _mm_set1_epi32(0xFF);
+
+    int x = 0;
+
+    for (; x + 16 <= w; x += 16)    // 16 pixels in, 16 bytes out
+    {
+        __m128i g0 = luma4_sse2(_mm_loadu_si128((const __m128i *)(src + x)), crg, cb, mask_g, mask_b);
+        __m128i g1 = luma4_sse2(_mm_loadu_si128((const __m128i *)(src + x + 4)), crg, cb, mask_g, mask_b);
+        __m128i g2 = luma4_sse2(_mm_loadu_si128((const __m128i *)(src + x + 8)), crg, cb, mask_g, mask_b);
+        __m128i g3 = luma4_sse2(_mm_loadu_si128((const __m128i *)(src + x + 12)), crg, cb, mask_g, mask_b);
+
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(g0, g1), _mm_packs_epi32(g2, g3));
+        _mm_storeu_si128((__m128i *)(dst + x), packed);
+    }
+
+    gray_row_scalar(src + x, dst + x, w - x);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i luma8_avx2(__m256i p, __m256i crg, __m256i cb, __m256i mask_g, __m256i mask_b)
+{
+    __m256i rg = _mm256_or_si256(_mm256_srli_epi32(p, 24), _mm256_and_si256(p, mask_g));
+    __m256i b = _mm256_and_si256(_mm256_srli_epi32(p, 8), mask_b);
+
+    __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(rg, crg), _mm256_madd_epi16(b, cb));
+
+    return _mm256_srli_epi32(sum, LUMA_SHIFT);
+}
+
+__attribute__((target("avx2")))
+static void gray_row_avx2(const Uint32 *src, uint8_t *dst, int w)
+{
+    __m256i crg = _mm256_set1_epi32((LUMA_G << 16) | LUMA_R);
+    __m256i cb = _mm256_set1_epi32(LUMA_B);
+    __m256i mask_g = _mm256_set1_epi32(0x00FF0000);
+    __m256i mask_b = _mm256_set1_epi32(0xFF);
+    __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);   // packs work per 128 bit lane, put the dwords back in order
+
+    int x = 0;
+
+    for (; x + 32 <= w; x += 32)    // 32 pixels in, 32 bytes out
+    {
+        __m256i g0 = luma8_avx2(_mm256_loadu_si256((const __m256i *)(src + x)), crg, cb, mask_g, mask_b);
+        __m256i g1 = luma8_avx2(_mm256_loadu_si256((const __m256i *)(src + x + 8)), crg, cb, mask_g, mask_b);
+        __m256i g2 = luma8_avx2(_mm256_loadu_si256((const __m256i *)(src + x + 16)), crg, cb, mask_g, mask_b);
+        __m256i g3 = luma8_avx2(_mm256_loadu_si256((const __m256i *)(src + x + 24)), crg, cb, mask_g, mask_b);
+
+        __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(g0, g1), _mm256_packs_epi32(g2, g3));
+        _mm256_storeu_si256((__m256i *)(dst + x), _mm256_permutevar8x32_epi32(packed, order));
+    }
+
+    gray_row_sse2(src + x, dst + x, w - x);
+}
+
+#endif
+
+static gray_row_fn pick_gray_row(void)  // chosen at runtime so one binary runs everywhere
+{
+#ifdef GRAY_SIMD
+    if (SDL_HasAVX2()) return gray_row_avx2;
+    if (SDL_HasSSE2()) return gray_row_sse2;
+#endif
+    return gray_row_scalar;
+}
+
+static void histogram_row(const uint8_t *row, int w, Uint32 sub[4][256])  // 4 sub histograms so equal neighbours do not wait on each other
+{
+    int x = 0;
+
+    for (; x + 4 <= w; x += 4)
+    {
+        sub[0][row[x]]++;
+        sub[1][row[x + 1]]++;
+        sub[2][row[x + 2]]++;
+        sub[3][row[x + 3]]++;
+    }
+
+    for (; x < w; x++)
+    {
+        sub[0][row[x]]++;
+    }
+}
+
+GrayImage* to_gray_scale(SDL_Surface *surface, int *hist)
 {
-    Uint8 r, g, b;
     Uint32* pixels = (Uint32*)surface -> pixels;
 
     int w = surface -> w;
@@ -14,16 +138,38 @@ void to_gray_scale(SDL_Surface *surface, int *hist)
 
     int pitch = surface -> pitch / 4;
 
+    GrayImage* image = gray_create(w, h);
+
+    gray_row_fn gray_row = pick_gray_row();
+    Uint32 sub[4][256] = {{0}};
+
     for (int y = 0; y < h; y++)
     {
-        for (int x = 0; x < w; x++)
+        uint8_t* row = image -> pixels + y * image -> stride;
+
+        if (surface -> format -> format == SDL_PIXELFORMAT_RGBA8888)
         {
-            SDL_GetRGB(pixels[y * pitch + x], surface -> format, &r, &g, &b);
-            Uint8 gray = (Uint8)(0.299 * r + 0.587 * g + 0.114 * b);
-            pixels[y * pitch + x] = SDL_MapRGB(surface -> format, gray, gray, gray);
-            hist[gray]++;
+            gray_row(pixels + y * pitch, row, w);
         }
+        else
+        {
+            for (int x = 0; x < w; x++)     // any other format goes through SDL
+            {
+                Uint8 r, g, b;
+                SDL_GetRGB(pixels[y * pitch + x], surface -> format, &r, &g, &b);
+                row[x] = (uint8_t)((r * LUMA_R + g * LUMA_G + b * LUMA_B) >> LUMA_SHIFT);
+            }
+        }
+
+        histogram_row(row, w, sub);
     }
+
+    for (int v = 0; v < 256; v++)
+    {
+        hist[v] += sub[0][v] + sub[1][v] + sub[2][v] + sub[3][v];
+    }
+
+    return image;
 }
 
 int Otsus_threshold(int *hist, int total)
@@ -68,101 +214,147 @@ int Otsus_threshold(int *hist, int total)
     return threshold;
 }
 
-void binarize(SDL_Surface *surface, int *hist)
+static int binarize_cut(int threshold)     // the contrast boost keeps the order of gray levels, so the threshold is a single cut
 {
-    Uint8 r, g, b;
-    Uint32* pixels = (Uint32*)surface -> pixels;
-        
-    int w = surface -> w;
-    int h = surface -> h;
+    for (int v = 0; v < 256; v++)
+    {
+        Uint8 r = v * v / 255;    // boost contrast
 
-    int pitch = surface -> pitch / 4;
+        if (r > threshold) return v;     // first white level
+    }
 
-    int threshold = Otsus_threshold(hist, w * h);
+    return 256;
+}
 
-    for (int y = 0; y < h; y++)
+BitImage* binarize(GrayImage *image, int *hist)   // the plane is left as is, the result is one bit per pixel
+{
+    if (binarize_method() != BINARIZE_OTSU)     // local thresholds, see adaptive.c
     {
-        for (int x = 0; x < w; x++)
-        {
-            SDL_GetRGB(pixels[y * pitch + x], surface->format, &r, &g, &b);
+        return binarize_adaptive(image);
+    }
 
-            r = r * r / 255;    // boost contrast
+    int w = image -> w;
+    int h = image -> h;
 
-            Uint8 value = (r > threshold) ? 255 : 0;
-            pixels[y * pitch + x] = SDL_MapRGB(surface->format, value, value, value);
-        }
+    int threshold = Otsus_threshold(hist, w * h);
+    int cut = binarize_cut(threshold);
+
+    BitImage* bits = bit_create(w, h);
+
+    for (int y = 0; y < h; y++)
+    {
+        bit_threshold_row(image -> pixels + y * image -> stride, w, cut, bit_row(bits, y));
     }
+
+    return bits;
 }
 
-int check_line(Uint32* pixels, SDL_PixelFormat* format, int x, int y, int pitch) // check if pixel at (x,y) is part of a line (horizontal or vertical)
+void denoise(GrayImage* image)  // median filter on the 3x3 neighborhood, see median.c
 {
-    Uint8 r1, r2;
-    Uint8 g1, g2;
-    Uint8 b1, b2;
-
-    SDL_GetRGB(pixels[y * pitch + (x - 1)], format, &r1, &g1, &b1); // left and right
-    SDL_GetRGB(pixels[y * pitch + (x + 1)], format, &r2, &g2, &b2);
+    denoise_kernel(image, 3);
+}
 
-    if(r1 != 255 && r2 != 255) return 1; // horizontal line (grayscaled so r=g=b)
+// to_gray_scale, denoise_kernel and binarize in two streaming passes over the RGBA rows :
+// the first one only converts each row to gray to build the histogram (otsu needs it before any row is cut),
+// the second one converts the rows again straight into a ring of size gray rows, filters the middle one
+// into a single output row and thresholds it into the bit image. only size + 1 gray rows are ever allocated,
+// the result is the same as calling the three steps one after the other.
+// the adaptive methods need the whole filtered plane, the output rows go into it and it is thresholded at the end.
+BitImage* preprocess_fused(SDL_Surface *surface, int size, int *hist)
+{
+    median_check_size(size);
 
-    SDL_GetRGB(pixels[(y - 1)* pitch + x], format, &r1, &g1, &b1); // top and bottom
-    SDL_GetRGB(pixels[(y + 1)* pitch + x], format, &r2, &g2, &b2);
+    if (surface -> format -> format != SDL_PIXELFORMAT_RGBA8888)   // the row kernels only read RGBA8888
+    {
+        GrayImage* image = to_gray_scale(surface, hist);
+        denoise_kernel(image, size);
 
-    if(r1 != 255 && r2 != 255) return 1; // vertical line
+        BitImage* bits = binarize(image, hist);
+        gray_free(image);
 
-    return 0;
-}
+        return bits;
+    }
 
+    Uint32* pixels = (Uint32*)surface -> pixels;
 
-void denoise(SDL_Surface* surface)  // simple denoise function using median filter, will compare the 3x3 neighborhood and take the median value
-{
     int w = surface -> w;
     int h = surface -> h;
 
-    Uint32* pixels = (Uint32*)surface -> pixels;
+    int pitch = surface -> pitch / 4;
+    int r = size / 2;
+    int stride = (w + 15) & ~15;
 
-    Uint32* copy = malloc(sizeof(Uint32) * w * h);  // do copy
-    memcpy(copy, pixels, sizeof(Uint32) * w * h);
+    uint8_t* ring = malloc((size_t)stride * (size + 1));     // gray rows y - r .. y + r, then the output row
 
-    int pitch = surface -> pitch / 4;
+    if (!ring)
+    {
+        errx(EXIT_FAILURE, "preprocess_fused: out of memory");
+    }
+
+    uint8_t* line = ring + (size_t)stride * size;
+
+    gray_row_fn gray_row = pick_gray_row();
+    Uint32 sub[4][256] = {{0}};
+
+    for (int y = 0; y < h; y++)     // first pass : histogram only
+    {
+        gray_row(pixels + y * pitch, line, w);
+        histogram_row(line, w, sub);
+    }
+
+    for (int v = 0; v < 256; v++)
+    {
+        hist[v] += sub[0][v] + sub[1][v] + sub[2][v] + sub[3][v];
+    }
+
+    int adaptive = (binarize_method() != BINARIZE_OTSU);
+
+    int threshold = Otsus_threshold(hist, w * h);
+
+    int cut = binarize_cut(threshold);
+
+    GrayImage* image = adaptive ? gray_create(w, h) : NULL;
+    BitImage* bits = adaptive ? NULL : bit_create(w, h);
+
+    int filtered = (w >= size && h >= size);
+    int next = 0;       // next gray row to convert into the ring
 
-    for (int y = 1; y < h - 1; y++)     // avoid borders
+    const uint8_t* rows[MEDIAN_MAX_SIZE];
+
+    for (int y = 0; y < h; y++)     // second pass : gray, median and threshold, one row at a time
     {
-        for (int x = 1; x < w - 1; x++)
+        for (; next <= y + r && next < h; next++)
         {
-            if(copy[y * pitch + x] == SDL_MapRGB(surface -> format, 255, 255, 255)) continue; // skip white pixels
+            gray_row(pixels + next * pitch, ring + (size_t)(next % size) * stride, w);
+        }
 
-            if(check_line(copy, surface -> format, x, y, pitch) == 1) continue; // skip if part of a line
+        uint8_t* out = adaptive ? image -> pixels + (size_t)y * image -> stride : line;
 
-            Uint8 gray[9], r, g, b;     // 3x3 neighborhood
-            int k = 0;
-            
-            for (int j = -1; j <= 1; j++)   // fill neighborhood
-            {
-                for (int i = -1; i <= 1; i++) 
-                {
-                    SDL_GetRGB(copy[(y + j) * pitch + (x + i)], surface -> format, &r, &g, &b);
-                    gray[k] = r;   // r=g=b since grayscale
-                    k++;
-                }
-            }
+        memcpy(out, ring + (size_t)(y % size) * stride, w);     // the median only writes the pixels it changes
 
-            for (int m = 0; m < 8; m++)         // simple bubble sort
+        if (filtered && y >= r && y < h - r)
+        {
+            for (int j = 0; j < size; j++)
             {
-                for (int n = m + 1; n < 9; n++) 
-                {
-                    if (gray[n] < gray[m]) 
-                    {
-                        Uint8 tmp = gray[m];
-                        gray[m] = gray[n];
-                        gray[n] = tmp;
-                    }
-                }
+                rows[j] = ring + (size_t)((y - r + j) % size) * stride;
             }
 
-            pixels[y * pitch + x] = SDL_MapRGB(surface -> format, gray[4], gray[4], gray[4]);   // replace with median
+            denoise_row(rows, size, out, w);
+        }
+
+        if (!adaptive)
+        {
+            bit_threshold_row(out, w, cut, bit_row(bits, y));
         }
     }
-    
-    free(copy);
-}
\ No newline at end of file
+
+    free(ring);
+
+    if (adaptive)
+    {
+        bits = binarize_adaptive(image);
+        gray_free(image);
+    }
+
+    return bits;
+}
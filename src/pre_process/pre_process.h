@@ -1,8 +1,30 @@
 #ifndef PRE_PROCESS_H
 #define PRE_PROCESS_H
 
-void to_gray_scale(SDL_Surface *surface, int *hist_ptr);
-void binarize(SDL_Surface *surface, int *hist);
-void denoise(SDL_Surface *surface);
+#include "../image/image.h"
+
+#define MEDIAN_MAX_SIZE 15
+#define BINARIZE_MAX_WINDOW 255    // keeps the window sums of squares within 32 bits
+
+typedef enum {
+    BINARIZE_OTSU,      // one global threshold
+    BINARIZE_SAUVOLA,   // local threshold from the mean and deviation of the window
+    BINARIZE_NIBLACK
+} BinarizeMethod;
+
+GrayImage* to_gray_scale(SDL_Surface *surface, int *hist_ptr);
+BitImage* binarize(GrayImage *image, int *hist);
+void denoise(GrayImage *image);
+void denoise_kernel(GrayImage *image, int size);
+BitImage* preprocess_fused(SDL_Surface *surface, int size, int *hist);
+
+int binarize_set_method(const char *name);
+BinarizeMethod binarize_method(void);
+const char* binarize_method_name(void);
+void binarize_set_window(int size);
+BitImage* binarize_adaptive(const GrayImage *image);
+
+void median_check_size(int size);
+void denoise_row(const uint8_t **rows, int size, uint8_t *out, int w);
 
 #endif
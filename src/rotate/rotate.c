@@ -1,163 +1,632 @@
 #include <stdlib.h>
 #include <err.h>
 #include <stdio.h>
+#include <string.h>
 #include <SDL2/SDL.h>
 #include "rotate.h"
+#include "../parallel/parallel.h"
+#include "../components/components.h"
 
-SDL_Surface* rotozoomSurface(SDL_Surface* surface, double angle_deg)
+// rotation engine : the source position of a destination pixel is stepped in 16.16 fixed point,
+// one addition per pixel. the destination is walked in bands of rows (one parallel task each)
+// and inside a band in tiles of columns, so the source rows read stay in cache.
+
+#define ROTATE_SHIFT 16
+#define ROTATE_ONE (1 << ROTATE_SHIFT)
+#define ROTATE_BAND 32          // destination rows per task
+#define ROTATE_TILE 128         // destination columns per tile, a multiple of 64 for the bit images
+
+static RotateMode rotate_mode = ROTATE_NEAREST;
+
+int rotate_set_mode(const char* name)    // 0 if the name is unknown
 {
-    double a = angle_deg * M_PI / 180.0;
-    double s = sin(a), c = cos(a);
+    if (strcmp(name, "nearest") == 0) rotate_mode = ROTATE_NEAREST;
+    else if (strcmp(name, "bilinear") == 0) rotate_mode = ROTATE_BILINEAR;
+    else return 0;
 
-    int sw = surface -> w;
-    int sh = surface -> h;
+    return 1;
+}
 
-    int dw = (int)ceil((fabs(sw * c) + fabs(sh * s)));
-    int dh = (int)ceil((fabs(sw * s) + fabs(sh * c)));
+const char* rotate_mode_name(void)
+{
+    return rotate_mode == ROTATE_BILINEAR ? "bilinear" : "nearest";
+}
 
-    SDL_Surface* rotated = SDL_CreateRGBSurfaceWithFormat(0, dw, dh, surface -> format -> BitsPerPixel, surface -> format -> format);
+typedef struct RotateJob RotateJob;
+typedef void (*rotate_span_fn)(const RotateJob* job, int x, int y, int n);
+
+struct RotateJob {
+    int sw, sh;             // source size
+    int dw, dh;             // destination size
+    int64_t ux, uy;         // source step for one destination pixel to the right
+    int64_t vx, vy;         // source step for one destination row down
+    int64_t ox, oy;         // source position of destination pixel (0, 0)
+    const void* src;
+    void* dst;
+    rotate_span_fn span;
+};
+
+static void rotate_setup(RotateJob* job, int sw, int sh, double angle_deg, RotateMode mode)   // destination size and fixed point steps
+{
+    double a = angle_deg * M_PI / 180.0;
+    double s = sin(a), c = cos(a);
 
-    Uint32 white = SDL_MapRGBA(rotated -> format, 255, 255, 255, 255);
-    SDL_FillRect(rotated, NULL, white);
+    job -> sw = sw;
+    job -> sh = sh;
+    job -> dw = (int)ceil((fabs(sw * c) + fabs(sh * s)));
+    job -> dh = (int)ceil((fabs(sw * s) + fabs(sh * c)));
 
     double scx = (sw - 1) * 0.5;
     double scy = (sh - 1) * 0.5;
-    double dcx = (dw - 1) * 0.5;
-    double dcy = (dh - 1) * 0.5;
+    double dcx = (job -> dw - 1) * 0.5;
+    double dcy = (job -> dh - 1) * 0.5;
+
+    double offset = (mode == ROTATE_NEAREST) ? 0.5 : 0.0;   // nearest floors sx + 0.5, bilinear keeps the fraction as weight
+
+    job -> ux = llround( c * ROTATE_ONE);
+    job -> uy = llround(-s * ROTATE_ONE);
+    job -> vx = llround( s * ROTATE_ONE);
+    job -> vy = llround( c * ROTATE_ONE);
+    job -> ox = llround(( c * -dcx + s * -dcy + scx + offset) * ROTATE_ONE);
+    job -> oy = llround((-s * -dcx + c * -dcy + scy + offset) * ROTATE_ONE);
+}
 
-    Uint32* sp = (Uint32*)surface -> pixels;
-    Uint32* dp = (Uint32*)rotated -> pixels;
+static inline int inside(const RotateJob* job, int ix, int iy)
+{
+    return (unsigned)ix < (unsigned)job -> sw && (unsigned)iy < (unsigned)job -> sh;
+}
+
+static inline int blend(int p00, int p01, int p10, int p11, int fx, int fy)   // weights are 8 bit fractions
+{
+    int top = p00 * (256 - fx) + p01 * fx;
+    int bottom = p10 * (256 - fx) + p11 * fx;
+
+    return (top * (256 - fy) + bottom * fy + 32768) >> 16;
+}
+
+#define SPAN_START(job, x, y) \
+    int64_t sx = (job) -> ox + (int64_t)(x) * (job) -> ux + (int64_t)(y) * (job) -> vx; \
+    int64_t sy = (job) -> oy + (int64_t)(x) * (job) -> uy + (int64_t)(y) * (job) -> vy
 
-    int sstride = surface -> pitch / 4;
-    int dstride = rotated -> pitch / 4;
+static void span_rgba_nearest(const RotateJob* job, int x, int y, int n)
+{
+    const SDL_Surface* src = job -> src;
+    SDL_Surface* dst = job -> dst;
+    const Uint32* sp = src -> pixels;
+    Uint32* out = (Uint32*)((Uint8*)dst -> pixels + (size_t)y * dst -> pitch) + x;
+    int sstride = src -> pitch / 4;
+    Uint32 white = SDL_MapRGBA(dst -> format, 255, 255, 255, 255);
+
+    SPAN_START(job, x, y);
 
-    for (int y = 0; y < dh; ++y) 
+    for (int i = 0; i < n; i++, sx += job -> ux, sy += job -> uy)
     {
-        double dy = y - dcy;
+        int ix = (int)(sx >> ROTATE_SHIFT);
+        int iy = (int)(sy >> ROTATE_SHIFT);
 
-        for (int x = 0; x < dw; ++x) 
-        {
-            double dx = x - dcx;
+        out[i] = inside(job, ix, iy) ? sp[(size_t)iy * sstride + ix] : white;
+    }
+}
+
+static void span_rgba_bilinear(const RotateJob* job, int x, int y, int n)   // every byte of the pixel is blended on its own
+{
+    const SDL_Surface* src = job -> src;
+    SDL_Surface* dst = job -> dst;
+    const Uint32* sp = src -> pixels;
+    Uint32* out = (Uint32*)((Uint8*)dst -> pixels + (size_t)y * dst -> pitch) + x;
+    int sstride = src -> pitch / 4;
+    Uint32 white = SDL_MapRGBA(dst -> format, 255, 255, 255, 255);
 
-            double sx =  c * dx + s * dy + scx + 0.5;
-            double sy = -s * dx + c * dy + scy + 0.5;
+    SPAN_START(job, x, y);
 
-            int ix = (int)floor(sx);
-            int iy = (int)floor(sy);
+    for (int i = 0; i < n; i++, sx += job -> ux, sy += job -> uy)
+    {
+        int ix = (int)(sx >> ROTATE_SHIFT);
+        int iy = (int)(sy >> ROTATE_SHIFT);
+        int fx = (int)(sx >> (ROTATE_SHIFT - 8)) & 255;
+        int fy = (int)(sy >> (ROTATE_SHIFT - 8)) & 255;
 
-            Uint32 color = white;
+        Uint32 p00 = inside(job, ix, iy)         ? sp[(size_t)iy * sstride + ix]           : white;
+        Uint32 p01 = inside(job, ix + 1, iy)     ? sp[(size_t)iy * sstride + ix + 1]       : white;
+        Uint32 p10 = inside(job, ix, iy + 1)     ? sp[(size_t)(iy + 1) * sstride + ix]     : white;
+        Uint32 p11 = inside(job, ix + 1, iy + 1) ? sp[(size_t)(iy + 1) * sstride + ix + 1] : white;
 
-            if ((unsigned)ix < (unsigned)sw && (unsigned)iy < (unsigned)sh) 
-            {
-                color = sp[iy * sstride + ix];
-            }
+        Uint32 color = 0;
 
-            dp[y * dstride + x] = color;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            color |= (Uint32)blend((p00 >> shift) & 255, (p01 >> shift) & 255,
+                                   (p10 >> shift) & 255, (p11 >> shift) & 255, fx, fy) << shift;
         }
+
+        out[i] = color;
     }
+}
 
-    return rotated;
+static inline int gray_at(const RotateJob* job, int ix, int iy)   // outside is white
+{
+    const GrayImage* src = job -> src;
+
+    return inside(job, ix, iy) ? src -> pixels[(size_t)iy * src -> stride + ix] : 255;
 }
 
-double compute_skew_angle(SDL_Surface* surface)
+static void span_gray_nearest(const RotateJob* job, int x, int y, int n)
 {
-    int w = surface -> w;
-    int h = surface -> h;
+    GrayImage* dst = job -> dst;
+    uint8_t* out = dst -> pixels + (size_t)y * dst -> stride + x;
 
-    Uint32* pixels = (Uint32*)surface -> pixels;
-    int pitch = surface -> pitch / 4;
+    SPAN_START(job, x, y);
 
-    double best_angle = 0.0;
-    double best_score = -1.0;
+    for (int i = 0; i < n; i++, sx += job -> ux, sy += job -> uy)
+    {
+        out[i] = (uint8_t)gray_at(job, (int)(sx >> ROTATE_SHIFT), (int)(sy >> ROTATE_SHIFT));
+    }
+}
+
+static void span_gray_bilinear(const RotateJob* job, int x, int y, int n)
+{
+    GrayImage* dst = job -> dst;
+    uint8_t* out = dst -> pixels + (size_t)y * dst -> stride + x;
 
-    double coarse_best = 0.0;
-    double coarse_score_best = -1.0;
+    SPAN_START(job, x, y);
 
-    for (double a = -30.0; a <= 30.0; a += 2.0)
+    for (int i = 0; i < n; i++, sx += job -> ux, sy += job -> uy)
     {
-        double s = sin(a * M_PI / 180.0);
-        double c = cos(a * M_PI / 180.0);
+        int ix = (int)(sx >> ROTATE_SHIFT);
+        int iy = (int)(sy >> ROTATE_SHIFT);
+        int fx = (int)(sx >> (ROTATE_SHIFT - 8)) & 255;
+        int fy = (int)(sy >> (ROTATE_SHIFT - 8)) & 255;
 
-        int proj[3000] = {0};
+        out[i] = (uint8_t)blend(gray_at(job, ix, iy), gray_at(job, ix + 1, iy),
+                                gray_at(job, ix, iy + 1), gray_at(job, ix + 1, iy + 1), fx, fy);
+    }
+}
+
+static inline int ink_at(const RotateJob* job, int ix, int iy)   // 255 for ink, outside is white
+{
+    return inside(job, ix, iy) && bit_get(job -> src, ix, iy) ? 255 : 0;
+}
+
+static void span_bits_nearest(const RotateJob* job, int x, int y, int n)   // x is a multiple of 64, whole words are written
+{
+    uint64_t* row = bit_row(job -> dst, y) + (x >> 6);
 
-        for (int y = 0; y < h; y++)
+    SPAN_START(job, x, y);
+
+    for (int k = 0; k < n; k += 64)
+    {
+        uint64_t word = 0;
+        int count = (n - k < 64) ? n - k : 64;
+
+        for (int i = 0; i < count; i++, sx += job -> ux, sy += job -> uy)
         {
-            for (int x = 0; x < w; x++)
-            {            
-                Uint8 r, g, b;
-                SDL_GetRGB(pixels[y * pitch + x], surface->format, &r, &g, &b);
-
-                if (r != 255)
-                {
-                    int yr = (int)(x * s + y * c) + 1500;
-                    if ((unsigned)yr < 3000)
-                        proj[yr]++;
-                }
-            }
+            int ix = (int)(sx >> ROTATE_SHIFT);
+            int iy = (int)(sy >> ROTATE_SHIFT);
+
+            if (inside(job, ix, iy) && bit_get(job -> src, ix, iy))
+                word |= (uint64_t)1 << i;
         }
 
-        double score = 0.0;
-        for (int i = 0; i < 3000; i++)
-            score += (double)proj[i] * (double)proj[i];
+        row[k >> 6] = word;
+    }
+}
 
-        if (score > coarse_score_best)
+static void span_bits_bilinear(const RotateJob* job, int x, int y, int n)   // ink when the blended ink reaches one half
+{
+    uint64_t* row = bit_row(job -> dst, y) + (x >> 6);
+
+    SPAN_START(job, x, y);
+
+    for (int k = 0; k < n; k += 64)
+    {
+        uint64_t word = 0;
+        int count = (n - k < 64) ? n - k : 64;
+
+        for (int i = 0; i < count; i++, sx += job -> ux, sy += job -> uy)
+        {
+            int ix = (int)(sx >> ROTATE_SHIFT);
+            int iy = (int)(sy >> ROTATE_SHIFT);
+            int fx = (int)(sx >> (ROTATE_SHIFT - 8)) & 255;
+            int fy = (int)(sy >> (ROTATE_SHIFT - 8)) & 255;
+
+            int ink = blend(ink_at(job, ix, iy), ink_at(job, ix + 1, iy),
+                            ink_at(job, ix, iy + 1), ink_at(job, ix + 1, iy + 1), fx, fy);
+
+            if (ink >= 128)
+                word |= (uint64_t)1 << i;
+        }
+
+        row[k >> 6] = word;
+    }
+}
+
+static void rotate_band(void* ctx, int index)
+{
+    const RotateJob* job = ctx;
+
+    int y0 = index * ROTATE_BAND;
+    int y1 = (y0 + ROTATE_BAND < job -> dh) ? y0 + ROTATE_BAND : job -> dh;
+
+    for (int x = 0; x < job -> dw; x += ROTATE_TILE)
+    {
+        int n = (job -> dw - x < ROTATE_TILE) ? job -> dw - x : ROTATE_TILE;
+
+        for (int y = y0; y < y1; y++)
         {
-            coarse_score_best = score;
-            coarse_best = a;
+            job -> span(job, x, y, n);
         }
     }
+}
+
+static void rotate_run(RotateJob* job)
+{
+    parallel_for((job -> dh + ROTATE_BAND - 1) / ROTATE_BAND, rotate_band, job);
+}
+
+SDL_Surface* rotozoomSurface(SDL_Surface* surface, double angle_deg)     // 32 bits per pixel surface, outside is white
+{
+    RotateJob job;
+    rotate_setup(&job, surface -> w, surface -> h, angle_deg, rotate_mode);
+
+    SDL_Surface* rotated = SDL_CreateRGBSurfaceWithFormat(0, job.dw, job.dh, surface -> format -> BitsPerPixel, surface -> format -> format);
 
-    for (double a = coarse_best - 2.0; a <= coarse_best + 2.0; a += 0.1)
+    if (rotated == NULL)
     {
-        double s = sin(a * M_PI / 180.0);
-        double c = cos(a * M_PI / 180.0);
+        errx(EXIT_FAILURE, "rotozoomSurface: %s", SDL_GetError());
+    }
+
+    job.src = surface;
+    job.dst = rotated;
+    job.span = (rotate_mode == ROTATE_BILINEAR) ? span_rgba_bilinear : span_rgba_nearest;
 
-        int proj[3000] = {0};
+    rotate_run(&job);
 
-        for (int y = 0; y < h; y++)
+    return rotated;
+}
+
+GrayImage* rotate_gray(const GrayImage* image, double angle_deg)     // same as rotozoomSurface on a grayscale plane
+{
+    RotateJob job;
+    rotate_setup(&job, image -> w, image -> h, angle_deg, rotate_mode);
+
+    GrayImage* rotated = gray_create(job.dw, job.dh);
+
+    job.src = image;
+    job.dst = rotated;
+    job.span = (rotate_mode == ROTATE_BILINEAR) ? span_gray_bilinear : span_gray_nearest;
+
+    rotate_run(&job);
+
+    return rotated;
+}
+
+BitImage* rotate_bits(const BitImage* image, double angle_deg)     // same as rotate_gray on a bit image, outside is white
+{
+    RotateJob job;
+    rotate_setup(&job, image -> w, image -> h, angle_deg, rotate_mode);
+
+    BitImage* rotated = bit_create(job.dw, job.dh);
+
+    job.src = image;
+    job.dst = rotated;
+    job.span = (rotate_mode == ROTATE_BILINEAR) ? span_bits_bilinear : span_bits_nearest;
+
+    rotate_run(&job);
+
+    return rotated;
+}
+
+// skew engine : the ink pixels are collected once, then every candidate angle projects them
+// on a buffer sized to the image with 16.16 fixed point and integer sums of squares.
+// the angles of one level are evaluated in parallel, each level refines around the best one.
+
+#define SKEW_FIXED_SHIFT 16
+
+typedef struct {
+    int count;
+    int32_t* x;
+    int32_t* y;
+    int offset;         // added to every projection so it is never negative
+    int bins;           // size of a projection buffer
+} InkPoints;
+
+typedef struct {
+    const InkPoints* points;
+    const double* angles;
+    int64_t* scores;
+} SkewJob;
+
+static void collect_ink(const BitImage* image, InkPoints* points)
+{
+    int count = 0;
+
+    for (int y = 0; y < image -> h; y++)
+    {
+        const uint64_t* row = bit_row(image, y);
+
+        for (int k = 0; k < image -> words; k++)
         {
-            for (int x = 0; x < w; x++)
+            count += __builtin_popcountll(row[k]);
+        }
+    }
+
+    points -> count = count;
+    points -> x = malloc(sizeof(int32_t) * (count > 0 ? count : 1));
+    points -> y = malloc(sizeof(int32_t) * (count > 0 ? count : 1));
+    points -> offset = image -> w + 1;
+    points -> bins = 2 * image -> w + image -> h + 3;
+
+    if (!points -> x || !points -> y)
+    {
+        errx(EXIT_FAILURE, "compute_skew_angle: out of memory");
+    }
+
+    int n = 0;
+
+    for (int y = 0; y < image -> h; y++)
+    {
+        const uint64_t* row = bit_row(image, y);
+
+        for (int k = 0; k < image -> words; k++)    // white words are skipped, ink bits are found with ctz
+        {
+            uint64_t word = row[k];
+
+            while (word)
             {
-                Uint8 r, g, b;
-                SDL_GetRGB(pixels[y * pitch + x], surface->format, &r, &g, &b);
-    
-                if (r != 255)
-                {
-                    int yr = (int)(x * s + y * c) + 1500;
-                    if ((unsigned)yr < 3000)
-                        proj[yr]++;
-                }
+                points -> x[n] = k * 64 + __builtin_ctzll(word);
+                points -> y[n] = y;
+                n++;
+
+                word &= word - 1;
             }
         }
+    }
+}
+
+static void projection_score(void* ctx, int index)     // sum of squares of the projection, high when text lines are horizontal
+{
+    SkewJob* job = ctx;
+    const InkPoints* points = job -> points;
+
+    double a = job -> angles[index] * M_PI / 180.0;
+
+    int64_t s = llround(sin(a) * (1 << SKEW_FIXED_SHIFT));
+    int64_t c = llround(cos(a) * (1 << SKEW_FIXED_SHIFT));
+
+    int32_t* proj = calloc(points -> bins, sizeof(int32_t));
+
+    if (!proj)
+    {
+        errx(EXIT_FAILURE, "compute_skew_angle: out of memory");
+    }
+
+    for (int i = 0; i < points -> count; i++)
+    {
+        int yr = (int)((points -> x[i] * s + points -> y[i] * c) >> SKEW_FIXED_SHIFT);
+        proj[yr + points -> offset]++;
+    }
+
+    int64_t score = 0;
+
+    for (int i = 0; i < points -> bins; i++)
+    {
+        score += (int64_t)proj[i] * proj[i];
+    }
+
+    job -> scores[index] = score;
+    free(proj);
+}
+
+static double best_angle_between(const InkPoints* points, double from, double step, int count)  // first best of from, from + step, ...
+{
+    double angles[64];
+    int64_t scores[64];
+
+    for (int i = 0; i < count; i++)
+    {
+        angles[i] = from + step * i;
+    }
+
+    SkewJob job = { points, angles, scores };
+    parallel_for(count, projection_score, &job);
+
+    int best = 0;
+
+    for (int i = 1; i < count; i++)
+    {
+        if (scores[i] > scores[best]) best = i;
+    }
+
+    return angles[best];
+}
+
+double compute_skew_angle(const BitImage* image)
+{
+    InkPoints points;
+    collect_ink(image, &points);
+
+    double angle = best_angle_between(&points, -30.0, 2.0, 31);     // 2 degrees over the whole range
+    angle = best_angle_between(&points, angle - 2.0, 0.5, 9);       // then 0.5 around it
+    angle = best_angle_between(&points, angle - 0.5, 0.1, 11);      // then 0.1
+
+    free(points.x);
+    free(points.y);
+
+    return angle;
+}
+
+// hough skew : every glyph votes once, with its centroid, for the lines going through it.
+// the votes are split between the two nearest distance bins so the score is smooth,
+// and the angle with the most concentrated votes wins. the cost grows with the number of glyphs.
+
+#define HOUGH_MIN_SIZE 5        // smaller components are noise
+#define HOUGH_MAX_SIZE 60       // bigger ones are grid lines or pictures
+#define HOUGH_STEPS 601         // -30 .. 30 by 0.1
+
+typedef struct {
+    int count;
+    const double* cx;
+    const double* cy;
+    double bin;                 // distance covered by one accumulator bin
+    double offset;              // added to every distance so it is never negative
+    int bins;
+    double* scores;
+} HoughJob;
+
+static void hough_score(void* ctx, int index)
+{
+    HoughJob* job = ctx;
+
+    double a = (-30.0 + 0.1 * index) * M_PI / 180.0;
+    double s = sin(a), c = cos(a);
+
+    double* votes = calloc(job -> bins, sizeof(double));
+
+    if (!votes)
+    {
+        errx(EXIT_FAILURE, "compute_skew_hough: out of memory");
+    }
+
+    for (int i = 0; i < job -> count; i++)
+    {
+        double rho = (job -> cx[i] * s + job -> cy[i] * c + job -> offset) / job -> bin;
+        int k = (int)rho;
+        double f = rho - k;
+
+        votes[k] += 1.0 - f;
+        votes[k + 1] += f;
+    }
+
+    double score = 0.0;
+
+    for (int i = 0; i < job -> bins; i++)
+    {
+        score += votes[i] * votes[i];
+    }
+
+    job -> scores[index] = score;
+    free(votes);
+}
+
+static int compare_int(const void* a, const void* b)
+{
+    return *(const int*)a - *(const int*)b;
+}
+
+double compute_skew_hough(const BitImage* image)
+{
+    Components* comps = components_label(image);
+
+    double* cx = malloc(sizeof(double) * (comps -> count + 1));
+    double* cy = malloc(sizeof(double) * (comps -> count + 1));
+    int* heights = malloc(sizeof(int) * (comps -> count + 1));
+
+    if (!cx || !cy || !heights)
+    {
+        errx(EXIT_FAILURE, "compute_skew_hough: out of memory");
+    }
 
-        double score = 0.0;
-        for (int i = 0; i < 3000; i++)
-            score += (double)proj[i] * (double)proj[i];
+    int count = 0;
 
-        if (score > best_score)
+    for (int i = 0; i < comps -> count; i++)
+    {
+        if (comps -> w[i] > HOUGH_MAX_SIZE || comps -> h[i] > HOUGH_MAX_SIZE) continue;
+        if (comps -> w[i] < HOUGH_MIN_SIZE && comps -> h[i] < HOUGH_MIN_SIZE) continue;
+
+        cx[count] = component_cx(comps, i);
+        cy[count] = component_cy(comps, i);
+        heights[count] = comps -> h[i];
+        count++;
+    }
+
+    components_free(comps);
+
+    double angle = 0.0;
+
+    if (count >= 2)
+    {
+        qsort(heights, count, sizeof(int), compare_int);
+
+        double bin = heights[count / 2] / 2.0;     // half a glyph
+        if (bin < 2.0) bin = 2.0;
+
+        double scores[HOUGH_STEPS];
+
+        HoughJob job = { count, cx, cy, bin, image -> w + 1.0, (int)((2.0 * image -> w + image -> h + 2.0) / bin) + 3, scores };
+        parallel_for(HOUGH_STEPS, hough_score, &job);
+
+        int best = 0;
+
+        for (int i = 1; i < HOUGH_STEPS; i++)
         {
-            best_score = score;
-            best_angle = a;
+            if (scores[i] > scores[best]) best = i;
         }
+
+        angle = -30.0 + 0.1 * best;
     }
 
-    return best_angle;
+    free(cx);
+    free(cy);
+    free(heights);
+
+    return angle;
 }
 
-SDL_Surface* rotate(SDL_Surface* surface) 
+static SkewMethod skew_method = SKEW_PROJECTION;
+static double skew_ms = 0.0;
+
+int skew_set_method(const char* name)    // 0 if the name is unknown
 {
-    double angle = compute_skew_angle(surface);
+    if (strcmp(name, "projection") == 0) skew_method = SKEW_PROJECTION;
+    else if (strcmp(name, "hough") == 0) skew_method = SKEW_HOUGH;
+    else return 0;
+
+    return 1;
+}
+
+const char* skew_method_name(void)
+{
+    return skew_method == SKEW_HOUGH ? "hough" : "projection";
+}
+
+double skew_last_ms(void)   // time taken by the last detection
+{
+    return skew_ms;
+}
+
+double compute_skew(const BitImage* image)  // with the method chosen by skew_set_method
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    double angle = (skew_method == SKEW_HOUGH) ? compute_skew_hough(image) : compute_skew_angle(image);
+
+    skew_ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+    return angle;
+}
+
+BitImage* rotate(BitImage* image, double *angle_out) 
+{
+    double angle = compute_skew(image);
     fflush(stdout);
 
-    if (fabs(angle) < 0.2) 
+    if (angle_out)
+        *angle_out = angle;
+
+    if (fabs(angle) < 0.2)      // a few pixels of drift across the page, not worth resampling
     {
         printf("Rotation not needed\n");
-        return surface; // No rotation needed
+        return image; // No rotation needed
     }
 
-    printf("Detected skew angle: %.2f degrees\n", angle);
+    printf("Detected skew angle: %.2f degrees (%s, %.2f ms)\n", angle, skew_method_name(), skew_ms);
+
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    BitImage *rotated = rotate_bits(image, angle);     // the exact angle, not rounded to a degree
 
-    SDL_Surface *rotated = rotozoomSurface(surface, round(angle));
+    printf("Rotated %.2f degrees (%s, %.2f ms)\n", angle, rotate_mode_name(),
+           (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency());
 
     return rotated;
 }
@@ -1,7 +1,29 @@
 #ifndef ROTATE_H
 #define ROTATE_H
 
-SDL_Surface *rotate(SDL_Surface *surface);
+#include "../image/image.h"
+
+typedef enum {
+    SKEW_PROJECTION,    // projection profile of every ink pixel
+    SKEW_HOUGH          // hough vote of every glyph centroid
+} SkewMethod;
+
+typedef enum {
+    ROTATE_NEAREST,     // closest source pixel
+    ROTATE_BILINEAR     // blend of the four closest source pixels
+} RotateMode;
+
+BitImage *rotate(BitImage *image, double *angle_out);
+double compute_skew_angle(const BitImage* image);
+double compute_skew_hough(const BitImage* image);
+double compute_skew(const BitImage* image);
+int skew_set_method(const char* name);
+const char* skew_method_name(void);
+double skew_last_ms(void);
+int rotate_set_mode(const char* name);
+const char* rotate_mode_name(void);
+BitImage* rotate_bits(const BitImage* image, double angle_deg);
+GrayImage* rotate_gray(const GrayImage* image, double angle_deg);
 SDL_Surface* rotozoomSurface(SDL_Surface* surface, double angle_deg);
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -0,0 +1,330 @@
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "segmentation.h"
+#include "../layout/layout.h"
+
+// ruled grids : the printed lines are found from the longest ink run of every row and of every column.
+// a line is a band of rows (or columns) whose longest run is close to the longest of the image,
+// the grid is accepted when both directions have regularly spaced lines that cross each other.
+// the cells are then the spaces between two lines and every cell is looked up on its own,
+// so the page does not need to be labeled to find the grid letters.
+
+#define GRID_LINE_RATIO 0.8f    // a line row is at least this part of the longest run
+#define GRID_MIN_LINES 3        // lines per direction, two cells
+#define GRID_SPACING 0.25f      // allowed gap deviation from the median gap
+#define GRID_MARGIN 2           // pixels of the cell border left out, line fringes
+
+static void* checked_malloc(size_t size)
+{
+    void* p = malloc(size ? size : 1);
+
+    if (!p)
+    {
+        errx(EXIT_FAILURE, "grid_lines: out of memory");
+    }
+
+    return p;
+}
+
+static void row_runs(const BitImage* image, int* longest, int* start)      // longest horizontal run of every row and where it starts
+{
+    for (int y = 0; y < image -> h; y++)
+    {
+        const uint64_t* row = bit_row(image, y);
+
+        longest[y] = 0;
+        start[y] = 0;
+
+        int x = bit_next_ink(row, image -> words, 0);
+
+        while (x >= 0)
+        {
+            int end = bit_next_white(row, x);
+
+            if (end - x > longest[y])
+            {
+                longest[y] = end - x;
+                start[y] = x;
+            }
+
+            x = (end < image -> w) ? bit_next_ink(row, image -> words, end) : -1;
+        }
+    }
+}
+
+static void column_runs(const BitImage* image, int* longest, int* start)     // longest vertical run of every column, visiting the ink pixels only
+{
+    int w = image -> w;
+
+    int* run_start = checked_malloc(w * sizeof(int));
+    int* last_ink = checked_malloc(w * sizeof(int));
+
+    for (int x = 0; x < w; x++)
+    {
+        longest[x] = 0;
+        start[x] = 0;
+        last_ink[x] = -2;
+    }
+
+    for (int y = 0; y < image -> h; y++)
+    {
+        const uint64_t* row = bit_row(image, y);
+
+        for (int k = 0; k < image -> words; k++)
+        {
+            uint64_t word = row[k];
+
+            while (word)
+            {
+                int x = k * 64 + __builtin_ctzll(word);
+                word &= word - 1;
+
+                if (last_ink[x] != y - 1) run_start[x] = y;
+                last_ink[x] = y;
+
+                if (y - run_start[x] + 1 > longest[x])
+                {
+                    longest[x] = y - run_start[x] + 1;
+                    start[x] = run_start[x];
+                }
+            }
+        }
+    }
+
+    free(run_start);
+    free(last_ink);
+}
+
+typedef struct {
+    int count;
+    int *lo, *hi;       // first and last row (or column) of every line
+    int *from, *to;     // extent of the line across, first and last pixel
+} Lines;
+
+static void lines_free(Lines* lines)
+{
+    free(lines -> lo);
+    free(lines -> hi);
+    free(lines -> from);
+    free(lines -> to);
+}
+
+// bands of consecutive rows (or columns) with a run close to the longest one, 0 if they do not look like grid lines
+static int find_lines(const int* longest, const int* start, int n, int min_length, Lines* lines)
+{
+    int max = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (longest[i] > max) max = longest[i];
+    }
+
+    lines -> count = 0;
+    lines -> lo = checked_malloc(n * sizeof(int));
+    lines -> hi = checked_malloc(n * sizeof(int));
+    lines -> from = checked_malloc(n * sizeof(int));
+    lines -> to = checked_malloc(n * sizeof(int));
+
+    if (max < min_length) return 0;
+
+    int threshold = (int)(max * GRID_LINE_RATIO);
+
+    for (int i = 0; i < n; i++)
+    {
+        if (longest[i] < threshold) continue;
+
+        int c = lines -> count;
+
+        if (c > 0 && lines -> hi[c - 1] == i - 1)     // same band
+        {
+            lines -> hi[c - 1] = i;
+
+            if (start[i] < lines -> from[c - 1]) lines -> from[c - 1] = start[i];
+            if (start[i] + longest[i] - 1 > lines -> to[c - 1]) lines -> to[c - 1] = start[i] + longest[i] - 1;
+
+            continue;
+        }
+
+        lines -> lo[c] = lines -> hi[c] = i;
+        lines -> from[c] = start[i];
+        lines -> to[c] = start[i] + longest[i] - 1;
+        lines -> count++;
+    }
+
+    if (lines -> count < GRID_MIN_LINES) return 0;
+
+    int gaps = lines -> count - 1;
+    int* gap = checked_malloc(gaps * sizeof(int));
+
+    for (int i = 0; i < gaps; i++)
+    {
+        gap[i] = lines -> lo[i + 1] - lines -> lo[i];
+    }
+
+    int median = layout_median(gap, gaps);
+    int regular = 1;
+
+    for (int i = 0; i < gaps && regular; i++)
+    {
+        if (gap[i] < median * (1.0f - GRID_SPACING) || gap[i] > median * (1.0f + GRID_SPACING)) regular = 0;
+        if (lines -> hi[i] - lines -> lo[i] + 1 > median / 3) regular = 0;     // a band that thick is a blot, not a line
+    }
+
+    free(gap);
+
+    return regular;
+}
+
+static int crosses(const Lines* lines, const Lines* across)    // every line spans from the first line across to the last one
+{
+    for (int i = 0; i < lines -> count; i++)
+    {
+        if (lines -> from[i] > across -> hi[0] + GRID_MARGIN) return 0;
+        if (lines -> to[i] < across -> lo[across -> count - 1] - GRID_MARGIN) return 0;
+    }
+
+    return 1;
+}
+
+GridLines* find_grid_lines(const BitImage* image)
+{
+    int w = image -> w;
+    int h = image -> h;
+
+    int* row_longest = checked_malloc(h * sizeof(int));
+    int* row_start = checked_malloc(h * sizeof(int));
+    int* col_longest = checked_malloc(w * sizeof(int));
+    int* col_start = checked_malloc(w * sizeof(int));
+
+    row_runs(image, row_longest, row_start);
+    column_runs(image, col_longest, col_start);
+
+    Lines across, down;     // horizontal and vertical lines
+
+    int found = find_lines(row_longest, row_start, h, w / 6, &across);
+    found = find_lines(col_longest, col_start, w, h / 6, &down) && found;
+    found = found && crosses(&across, &down) && crosses(&down, &across);
+
+    free(row_longest);
+    free(row_start);
+    free(col_longest);
+    free(col_start);
+
+    GridLines* grid = NULL;
+
+    if (found)
+    {
+        grid = checked_malloc(sizeof(GridLines));
+
+        grid -> rows = across.count - 1;
+        grid -> cols = down.count - 1;
+        grid -> y0 = checked_malloc(across.count * sizeof(int));
+        grid -> y1 = checked_malloc(across.count * sizeof(int));
+        grid -> x0 = checked_malloc(down.count * sizeof(int));
+        grid -> x1 = checked_malloc(down.count * sizeof(int));
+
+        memcpy(grid -> y0, across.lo, across.count * sizeof(int));
+        memcpy(grid -> y1, across.hi, across.count * sizeof(int));
+        memcpy(grid -> x0, down.lo, down.count * sizeof(int));
+        memcpy(grid -> x1, down.hi, down.count * sizeof(int));
+    }
+
+    lines_free(&across);
+    lines_free(&down);
+
+    return grid;
+}
+
+void grid_lines_free(GridLines* grid)
+{
+    if (!grid)
+        return;
+
+    free(grid -> y0);
+    free(grid -> y1);
+    free(grid -> x0);
+    free(grid -> x1);
+    free(grid);
+}
+
+SDL_Rect grid_lines_rect(const GridLines* grid)   // outer border included
+{
+    SDL_Rect rect = { grid -> x0[0], grid -> y0[0], grid -> x1[grid -> cols] - grid -> x0[0] + 1, grid -> y1[grid -> rows] - grid -> y0[0] + 1 };
+
+    return rect;
+}
+
+int grid_cell_glyph(const BitImage* image, const GridLines* grid, int row, int col, SDL_Rect* glyph)     // tight box of the ink inside a cell, 0 if the cell is empty
+{
+    int x0 = grid -> x1[col] + 1 + GRID_MARGIN;
+    int x1 = grid -> x0[col + 1] - 1 - GRID_MARGIN;
+    int y0 = grid -> y1[row] + 1 + GRID_MARGIN;
+    int y1 = grid -> y0[row + 1] - 1 - GRID_MARGIN;
+
+    if (x0 > x1 || y0 > y1) return 0;
+
+    int left = x1 + 1, right = -1, top = -1, bottom = -1;
+
+    for (int y = y0; y <= y1; y++)
+    {
+        const uint64_t* line = bit_row(image, y);
+        int found = 0;
+
+        for (int k = x0 >> 6; k <= x1 >> 6; k++)
+        {
+            int from = (k == x0 >> 6) ? (x0 & 63) : 0;
+            int to = (k == x1 >> 6) ? (x1 & 63) + 1 : 64;
+
+            uint64_t word = line[k] & bit_span_mask(from, to);
+
+            if (!word) continue;
+
+            int first = k * 64 + __builtin_ctzll(word);
+            int last = k * 64 + 63 - __builtin_clzll(word);
+
+            if (first < left) left = first;
+            if (last > right) right = last;
+
+            found = 1;
+        }
+
+        if (found)
+        {
+            if (top < 0) top = y;
+            bottom = y;
+        }
+    }
+
+    if (top < 0) return 0;
+
+    glyph -> x = left;
+    glyph -> y = top;
+    glyph -> w = right - left + 1;
+    glyph -> h = bottom - top + 1;
+
+    return 1;
+}
+
+void grid_lines_clear(BitImage* image, const GridLines* grid)     // lines and letters of the grid go, the words around stay
+{
+    SDL_Rect rect = grid_lines_rect(grid);
+
+    int x0 = rect.x;
+    int x1 = rect.x + rect.w - 1;
+
+    for (int y = rect.y; y < rect.y + rect.h; y++)
+    {
+        uint64_t* row = bit_row(image, y);
+
+        for (int k = x0 >> 6; k <= x1 >> 6; k++)
+        {
+            int from = (k == x0 >> 6) ? (x0 & 63) : 0;
+            int to = (k == x1 >> 6) ? (x1 & 63) + 1 : 64;
+
+            row[k] &= ~bit_span_mask(from, to);
+        }
+    }
+}
@@ -3,10 +3,26 @@
 #include <stdio.h>
 #include <SDL2/SDL.h>
 #include "segmentation.h"
+#include "../components/components.h"
+#include "../layout/layout.h"
+#include "../writer/writer.h"
+#include "../parallel/parallel.h"
+#include "../arena/arena.h"
+
+#define PAGE_PASS 0         // scanning the whole page
+#define REGION_PASS 1       // scanning the grid or a word
+
+#define LETTER_MIN_W 2      // smaller boxes are noise
+#define LETTER_MIN_H 13
+#define LETTER_MAX_W 60     // bigger boxes are grid lines or rules
+#define LETTER_MAX_H 60
 
 typedef struct {
     int x, y, w, h;         // bounding box, (x,y) is top-left corner
-    SDL_Surface* surface;   // cropped letter surface
+    int area;               // ink pixels, only set for letters
+    float cx, cy;           // centroid of the ink, only set for letters
+    BitView view;           // letter bits read in place in the image it was found in, only set for letters
+    BitImage* owned;        // copy the view points to once the image changed under the letter, or NULL
 } LetterBox;
 
 void draw_rectangle_on_surface(SDL_Surface* surface, LetterBox box, Uint8 r, Uint8 g, Uint8 b, int thickness, int expand)
@@ -42,175 +58,163 @@ void draw_rectangle_on_surface(SDL_Surface* surface, LetterBox box, Uint8 r, Uin
     }
 }
 
-void flood_fill(SDL_Surface* surface, int start_x, int start_y, Uint32 visited_color, SDL_Rect* bbox)
+BitImage* crop_surface(BitImage* image, SDL_Rect bbox)     // owned copy, for the grid and the words that are cleared letter by letter
 {
-    int w = surface -> w;
-    int h = surface -> h;
-
-    Uint32* pixels = (Uint32*)surface -> pixels;
-    int pitch = surface -> pitch / 4;
-
-    int min_x = start_x, max_x = start_x;   // initialize bounding box coordinates
-    int min_y = start_y, max_y = start_y;
-
-    typedef struct { int x, y; } Pixel;     // represents pixel coordinates
-
-    Pixel* stack = malloc(w * h * sizeof(Pixel));       // w * h not really necessary but safe
-    int stack_size = 0;
-    stack[stack_size++] = (Pixel){start_x, start_y};    // push starting point and increment
+    return bit_crop(image, bbox.x, bbox.y, bbox.w, bbox.h);     // copy bbox from src to dst
+}
 
-    while(stack_size > 0) 
+// removes a rejected box from the page : every visited pixel under the box goes (grid lines, noise)
+void clear_surface(BitImage* image, BitImage* visited, int x, int y, int w, int h)
+{
+    for(int j = y; j < y + h; j++)
     {
-        Pixel p = stack[--stack_size];  // decrement and pop
-
-        int index = p.y * pitch + p.x;
-        
-        if (pixels[index] == visited_color) continue;   // already visited
-
-        Uint8 r, g, b, a;
-        SDL_GetRGBA(pixels[index], surface -> format, &r, &g, &b, &a);
+        uint64_t* row = bit_row(image, j);
+        const uint64_t* seen = bit_row(visited, j);
 
-        if (r == 255 && g == 255 && b == 255) continue; // skips white pixel
-
-        pixels[index] = visited_color;  // mark visited
-
-        if(p.x < min_x) min_x = p.x;    // update bounding box coordinates
-        if(p.x > max_x) max_x = p.x;
-        if(p.y < min_y) min_y = p.y;
-        if(p.y > max_y) max_y = p.y;
+        for(int k = x >> 6; k <= (x + w - 1) >> 6; k++)
+        {
+            int from = (k == x >> 6) ? (x & 63) : 0;
+            int to = (k == (x + w - 1) >> 6) ? ((x + w - 1) & 63) + 1 : 64;
 
-        if(p.x > 0) stack[stack_size++] = (Pixel){p.x - 1, p.y};        // add left neighbor
-        if(p.x < w - 1) stack[stack_size++] = (Pixel){p.x + 1, p.y};    // add right neighbor
-        if(p.y > 0) stack[stack_size++] = (Pixel){p.x, p.y - 1};        // add top neighbor
-        if(p.y < h - 1) stack[stack_size++] = (Pixel){p.x, p.y + 1};    // add bottom neighbor
+            row[k] &= ~(bit_span_mask(from, to) & seen[k]);
+        }
     }
-
-    bbox -> x = min_x;
-    bbox -> y = min_y;
-    bbox -> w = max_x - min_x + 1;   // +1 to include the pixel at max_x and max_y
-    bbox -> h = max_y - min_y + 1;
-
-    free(stack);
 }
 
-SDL_Surface* crop_surface(SDL_Surface* surface, SDL_Rect bbox)
+// a region is cleared under rejected boxes while its letters are still views into it :
+// the letters the box overlaps get their own copy first, they are saved as they were found
+static void detach_letters(LetterBox* boxes, int count, SDL_Rect box)
 {
-    SDL_Surface* cropped = SDL_CreateRGBSurfaceWithFormat(0, bbox.w, bbox.h, surface -> format -> BitsPerPixel, surface -> format -> format);
-    SDL_BlitSurface(surface, &bbox, cropped, NULL);     // copy bbox from src to dst
+    for(int i = 0; i < count; i++)
+    {
+        LetterBox* letter = &boxes[i];
+
+        if(letter -> owned) continue;
+        if(letter -> x >= box.x + box.w || box.x >= letter -> x + letter -> w) continue;
+        if(letter -> y >= box.y + box.h || box.y >= letter -> y + letter -> h) continue;
 
-    return cropped;
+        letter -> owned = bit_view_copy(letter -> view);
+        letter -> view = bit_view(letter -> owned, 0, 0, letter -> w, letter -> h);
+    }
 }
 
-void clear_surface(SDL_Surface* surface, int x, int y, int w, int h)
+static void free_letters(LetterBox* boxes, int count)     // the copies of detached letters, the array belongs to the arena
 {
-    Uint32* pixels = (Uint32*)surface -> pixels;
-    int pitch = surface -> pitch / 4;
-
-    for(int i = x; i < x + w; i++)
+    for(int i = 0; i < count; i++)
     {
-        for(int j = y; j < y + h; j++)
-        {
-            Uint8 r, g, b, a;
-            int index = j * pitch + i;
-            SDL_GetRGBA(pixels[index], surface -> format, &r, &g, &b, &a);
-
-            if(r == 255 && g == 0 && b == 0)
-            {
-                pixels[index] = SDL_MapRGBA(surface -> format, 255, 255, 255, 255);
-            }
-        }
+        bit_free(boxes[i].owned);
     }
 }
 
-LetterBox* extract_letters(SDL_Surface* surface, int* out_count, Uint8 color_r, Uint8 color_g, Uint8 color_b)
+static int letter_size(SDL_Rect box)
 {
-    int capacity = 64;          // starting capacity, will realloc if needed
-    int count = 0;              // tracker to reallocate
-
-    LetterBox* boxes = malloc(capacity * sizeof(LetterBox));                // dynamic array of letter boxes
-    Uint32 visited_color = SDL_MapRGBA(surface -> format, color_r, color_g, color_b, 255);    // arbitrary visited color (red)
+    return box.w >= LETTER_MIN_W && box.h >= LETTER_MIN_H && box.w <= LETTER_MAX_W && box.h <= LETTER_MAX_H;
+}
 
-    int w = surface -> w;       // pixels per row
-    int h = surface -> h;       // n of rows
+LetterBox* extract_letters(Arena* arena, BitImage* image, int* out_count, int pass)
+{
+    int capacity = 64;          // starting capacity, will grow if needed
+    int count = 0;              // tracker to grow
 
-    int min_w = 2;              // min w threshold
-    int min_h = 13;              // min h threshold
+    LetterBox* boxes = arena_alloc(arena, capacity * sizeof(LetterBox));    // dynamic array of letter boxes
 
-    int max_w = 60;             // max w threshold
-    int max_h = 60;             // max h threshold
+    int w = image -> w;         // pixels per row
+    int h = image -> h;         // n of rows
 
-    Uint32* pixels = (Uint32*)surface -> pixels;    // raw pixels
-    int pitch = surface -> pitch / 4;               // n of bytes per row / 4 bc theres 4 bytes per pixel (RGBA8888 format)
+    BitImage* visited = (pass == PAGE_PASS) ? bit_create(w, h) : NULL;  // pixels of the components already seen, to clear the page
+    Components* comps = components_label(image);    // in the order a scan of the image meets them
 
-    for(int y = 0; y < h; y++) 
+    for(int i = 0; i < comps -> count; i++)
     {
-        for(int x = 0; x < w; x++) 
-        {
-            int index = y * pitch + x;      // index in the pixel array
-            Uint8 r, g, b, a;
+        if(visited)
+            components_paint(comps, i, visited);
 
-            SDL_GetRGBA(pixels[index], surface -> format, &r, &g, &b, &a);
+        SDL_Rect box = { comps -> x[i], comps -> y[i], comps -> w[i], comps -> h[i] };
 
-            if(!(r == 255 && g == 255 && b == 255) && pixels[index] != visited_color)  // not white nor visited
-            {
-                if(count >= capacity)       // realloc if needed
-                {
-                    capacity *= 2;
-                    boxes = realloc(boxes, capacity * sizeof(LetterBox));
-                }
+        if(!letter_size(box))    // ignore small noises and big boxes like grid or lines
+        {
+            if(pass == REGION_PASS)     // page letters are only used for their boxes
+                detach_letters(boxes, count, box);
 
-                SDL_Rect box;                                     // creates rectangle for bounding box
-                flood_fill(surface, x, y, visited_color, &box);   // flood fill to find bounding box
+            // inside a region only the ink of this component goes, the components not reached yet
+            // keep all their pixels so their labels stay valid and the image is labeled once
+            if(pass == REGION_PASS) components_erase(comps, i, image);
+            else clear_surface(image, visited, box.x, box.y, box.w, box.h);
 
-                if(box.w < min_w || box.h < min_h || box.w > max_w || box.h > max_h)    // ignore small noises and big boxes like grid or lines
-                {
-                    clear_surface(surface, box.x, box.y, box.w, box.h);
-                    continue;
-                }
-            
-                boxes[count].x = box.x;       // store bounding box
-                boxes[count].y = box.y;
-                boxes[count].w = box.w;
-                boxes[count].h = box.h;
-                boxes[count].surface = crop_surface(surface, box);
+            continue;
+        }
 
-                count++;
-            }
+        if(count >= capacity)       // grow if needed, in place while nothing else was allocated
+        {
+            boxes = arena_grow(arena, boxes, capacity * sizeof(LetterBox), 2 * capacity * sizeof(LetterBox));
+            capacity *= 2;
         }
+
+        boxes[count].x = box.x;       // store bounding box
+        boxes[count].y = box.y;
+        boxes[count].w = box.w;
+        boxes[count].h = box.h;
+        boxes[count].area = comps -> area[i];
+        boxes[count].cx = (float)component_cx(comps, i);
+        boxes[count].cy = (float)component_cy(comps, i);
+        boxes[count].view = bit_view(image, box.x, box.y, box.w, box.h);
+        boxes[count].owned = NULL;
+
+        count++;
     }
 
+    components_free(comps);
+    bit_free(visited);
+
     *out_count = count;
     return boxes;
 }
 
-int compare_letters(const void* a, const void* b)   // VERY IMPORTANT 
+// reading order and grid cells come from the layout module : rows and columns of letter centroids
+static Layout* letters_layout(Arena* arena, const LetterBox* letters, int n, float row_gap, float col_gap)
 {
-    const LetterBox* A = a;
-    const LetterBox* B = b;
-
-    int centerA = A -> y + A -> h / 2;
-    int centerB = B -> y + B -> h / 2;
+    float* cx = arena_alloc(arena, n * sizeof(float));
+    float* cy = arena_alloc(arena, n * sizeof(float));
 
-    if (abs(centerA - centerB) > 5) // delta y
+    for(int i = 0; i < n; i++)
     {
-        return A -> y - B -> y; // top to bottom
-    }
-    else if (abs(A -> h - B -> h) > 8) // delta h
-    {
-        return A -> y - B -> y; // top to bottom
-    }
-    else 
-    {
-        return A -> x - B -> x; // left to right
+        cx[i] = letters[i].cx;
+        cy[i] = letters[i].cy;
     }
+
+    return layout_build(cx, cy, n, row_gap, col_gap);
+}
+
+static float median_height(Arena* arena, const LetterBox* letters, int n)
+{
+    int* heights = arena_alloc(arena, n * sizeof(int));
+
+    for(int i = 0; i < n; i++)
+        heights[i] = letters[i].h;
+
+    return (float)layout_median(heights, n);
 }
 
-int compute_median_dx(LetterBox* letters, int n)
+void reading_order(Arena* arena, LetterBox* letters, int n, float row_gap)    // rows top to bottom, letters left to right inside a row
+{
+    Layout* layout = letters_layout(arena, letters, n, row_gap, 0.0f);     // no column gap : one column per x
+
+    LetterBox* sorted = arena_alloc(arena, n * sizeof(LetterBox));
+
+    for(int i = 0; i < n; i++)
+        sorted[i] = letters[layout -> order[i]];
+
+    memcpy(letters, sorted, n * sizeof(LetterBox));
+
+    layout_free(layout);
+}
+
+int compute_median_dx(Arena* arena, LetterBox* letters, int n)
 {
     if (n <= 1)
         return 0;
 
-    int gaps[n - 1];
+    int* gaps = arena_alloc(arena, (n - 1) * sizeof(int));     // was on the stack, as big as the page has letters
     int count = 0;
 
     for (int i = 1; i < n; i++)
@@ -241,12 +245,12 @@ int compute_median_dx(LetterBox* letters, int n)
         return (gaps[count/2 - 1] + gaps[count/2]) / 2;
 }
 
-void extract_boxes(SDL_Surface* surface, LetterBox* letters, int n_letters, LetterBox** out_boxes, int* out_count, int* out_max)
+void extract_boxes(Arena* arena, LetterBox* letters, int n_letters, LetterBox** out_boxes, int* out_count, int* out_max)
 {
-    LetterBox* boxes = malloc(n_letters * sizeof(LetterBox));
+    LetterBox* boxes = arena_calloc(arena, n_letters, sizeof(LetterBox));      // word boxes have no letter statistics nor view
     int count = 0;
     int max_w = 0;
-    int median_dx = compute_median_dx(letters, n_letters);
+    int median_dx = compute_median_dx(arena, letters, n_letters);
 
     int x = 0, y = 0, w = 0, h = 0;
 
@@ -283,10 +287,6 @@ void extract_boxes(SDL_Surface* surface, LetterBox* letters, int n_letters, Lett
             boxes[count].y = y;
             boxes[count].w = w;
             boxes[count].h = h;
-
-            SDL_Rect rect = { x, y, w, h };
-
-            boxes[count].surface = crop_surface(surface, rect);
             count++;
 
             if(w > max_w)   max_w = w;
@@ -315,12 +315,24 @@ void extract_boxes(SDL_Surface* surface, LetterBox* letters, int n_letters, Lett
     *out_max = max_w;
 }
 
-LetterBox build_grid(SDL_Surface* surface, LetterBox* boxes, int box_count, int max_w, int* out_count, int* out_garbage)
+static int text_height(Arena* arena, const LetterBox* boxes, int count)    // median height of the boxes, a line of text
+{
+    return (int)median_height(arena, boxes, count);
+}
+
+static int header_garbage(LetterBox box, int text_h)     // small header boxes or a title line
+{
+    return box.y < 100 && (box.w < 80 || box.h > 2 * text_h);
+}
+
+LetterBox build_grid(Arena* arena, LetterBox* boxes, int box_count, int max_w, int* out_count, int* out_garbage)
 {
     int x = 0, y = 0, h = 0;
 
     int words_count = 0;
     int garbage_count = 0;
+
+    int text_h = text_height(arena, boxes, box_count);
     
     for(int i = 0; i < box_count; i++)
     {
@@ -344,7 +356,7 @@ LetterBox build_grid(SDL_Surface* surface, LetterBox* boxes, int box_count, int
         }
         else
         {
-            if(x == 0 && boxes[i].y < 100 && boxes[i].w < 80)
+            if(x == 0 && header_garbage(boxes[i], text_h))
             {
                 garbage_count++;
             }
@@ -353,157 +365,382 @@ LetterBox build_grid(SDL_Surface* surface, LetterBox* boxes, int box_count, int
         }
     }
 
-    LetterBox grid;
+    LetterBox grid = {0};
     grid.x = x;
     grid.y = y;
     grid.w = max_w;
     grid.h = h;
 
-    SDL_Rect rect = { x, y, max_w, h };
-
-    grid.surface = crop_surface(surface, rect);
-
     *out_count = words_count;
     *out_garbage = garbage_count;
 
     return grid;
 }
 
-void save_letters(SDL_Surface* surface, SDL_Surface* display, char* file) {
+static CorpusWriter* corpus = NULL;     // letters go to the packed corpus instead of bitmaps when set
+static GlyphBatch* batch = NULL;        // letters go to the recognizer batch, no file at all, when set
+static const CorpusLabels* labels = NULL;   // letters of the corpus glyphs, by grid cell or word and letter, when set
 
-    int n_letters;      // number of detected letters
+void segmentation_set_corpus(CorpusWriter* writer)
+{
+    corpus = writer;
+}
 
-    LetterBox* letters = extract_letters(surface, &n_letters, 255, 0, 0);
-    qsort(letters, n_letters, sizeof(LetterBox), compare_letters);
+void segmentation_set_labels(const CorpusLabels* letters)
+{
+    labels = letters;
+}
 
-    LetterBox* boxes;
-    int box_count;
-    int max_box_w;
+void segmentation_set_batch(GlyphBatch* glyphs)
+{
+    batch = glyphs;
+}
 
-    extract_boxes(surface, letters, n_letters, &boxes, &box_count, &max_box_w);
+static void store_tile(const uint8_t* tile, int w, int h, CorpusKind kind, int name_len, const char* name, int i, int j)     // batch or corpus
+{
+    if(batch)
+    {
+        memcpy(glyph_batch_add(batch, i, j), tile, GLYPH_PIXELS);
+        return;
+    }
 
-    int words_count;
-    int garbage_count;
+    char source[CORPUS_SOURCE];
+
+    snprintf(source, sizeof(source), "%.*s", name_len, name);
+    corpus_append(corpus, tile, w, h, source, kind, i, j, labels ? corpus_label(labels, kind, i, j) : 0);
+}
+
+// cx, cy : centre of mass of the letter in pixels of its view, scratch : for the batch and the corpus, GLYPH_SCRATCH of the letter width
+static void save_letter(BitView view, float cx, float cy, CorpusKind kind, int name_len, const char* name, int i, int j, float* scratch)
+{
+    if(batch || corpus)
+    {
+        uint8_t tile[GLYPH_PIXELS];
 
-    LetterBox grid = build_grid(surface, boxes, box_count, max_box_w, &words_count, &garbage_count);
+        glyph_normalize(view, cx, cy, tile, scratch);
+        store_tile(tile, view.w, view.h, kind, name_len, name, i, j);
 
-    draw_rectangle_on_surface(display, grid, 255, 0, 0, 4, 10);
+        return;
+    }
+
+    char filename[128];
 
-    printf("Detected %d garbages\n", garbage_count);
-    printf("Detected %d words\n", words_count - garbage_count);
-    LetterBox* words = malloc((words_count - garbage_count)* sizeof(LetterBox));
+    if(kind == CORPUS_GRID)
+        snprintf(filename, sizeof(filename), "datasets/%.*s/grid_letters/letter[%d,%d].bmp", name_len, name, i, j);
+    else
+        snprintf(filename, sizeof(filename), "datasets/%.*s/words_letters/word[%d,%d].bmp", name_len, name, i, j);
 
-    int words_index = 0;
+    writer_save_bits(view, filename);     // written in the background, the errors come with writer_wait, safe from any thread
+}
 
-    for(int i = 0; i < box_count; i++) 
+// ruled grid : the letter of every cell is the ink between its lines, no labeling
+static int save_ruled_grid(Arena* arena, BitImage* image, const GridLines* grid, int name_len, const char* name)
+{
+    int n_grid_letters = 0;
+    float* scratch = (batch || corpus) ? arena_alloc(arena, GLYPH_SCRATCH(image -> w) * sizeof(float)) : NULL;     // a cell is never wider than the page
+
+    for(int row = 0; row < grid -> rows; row++)
     {
-        if(abs(max_box_w - boxes[i].w) > 20)
+        for(int col = 0; col < grid -> cols; col++)
         {
-            if(words_index >= garbage_count)
-            {
-                words[words_index - garbage_count] = boxes[i];
-                draw_rectangle_on_surface(display, boxes[i], 0, 0, 255, 2, 5);
+            SDL_Rect glyph;
 
-                if(words_index == words_count)  break;
-            }
+            if(!grid_cell_glyph(image, grid, row, col, &glyph) || !letter_size(glyph)) continue;     // empty cell or a speck
+
+            BitView view = bit_view(image, glyph.x, glyph.y, glyph.w, glyph.h);
+            float cx, cy;
 
-            words_index++;
+            glyph_mass_centre(view, &cx, &cy);
+            save_letter(view, cx, cy, CORPUS_GRID, name_len, name, row, col, scratch);
+            n_grid_letters++;
         }
     }
 
-    int n_grid_letters;
+    printf("Detected %d letters from the ruled grid (%dx%d cells)\n", n_grid_letters, grid -> rows, grid -> cols);
 
-    LetterBox* grid_letters = extract_letters(grid.surface, &n_grid_letters, 0, 0, 255);
-    qsort(grid_letters, n_grid_letters, sizeof(LetterBox), compare_letters);
+    return n_grid_letters;
+}
 
-    printf("Detected %d letters from the grid\n", n_grid_letters);
+// the grid and every word are regions segmented on their own copy, as tasks of the worker pool.
+// the bitmaps are written by the tasks themselves (their names do not depend on the order), while
+// the batch and the corpus get the normalized letters afterwards, region after region, in the serial order.
+// every region has its own arena : the tasks never share one, and the arenas are kept for the next image.
+typedef struct {
+    Arena* arena;
+    SDL_Rect rect;
+    CorpusKind kind;
+    int index;              // word number, unused for the grid
+    int count;              // letters found
+    int saved;              // letters saved, a grid cell saves only one of the letters sharing it
+    SDL_Rect* boxes;        // saved letters in saving order, in pixels of the region
+    int *i, *j;             // their position, grid row and column or word and letter
+    uint8_t* tiles;         // their glyphs, only for the batch and the corpus
+    float* scratch;         // of glyph_normalize, from the region arena, with the tiles
+} Region;
 
-    const char* dot = strrchr(file, '.');
-    const char* slash = strrchr(file, '/');
-    const char* start = (slash) ? slash + 1 : file;
+typedef struct {
+    BitImage* image;
+    Region* regions;
+    int name_len;
+    const char* name;
+} RegionJob;
 
-    int row = 0;
-    int col = 0;
+#define PAGE_ARENA (1 << 20)        // first block of the page arena
+#define REGION_ARENA (64 << 10)     // and of a region arena, most regions are a single word
 
-    int prev_y = 0;
+static Arena* page_arena = NULL;
+static Arena** region_arenas = NULL;
+static int n_region_arenas = 0;
 
-    for(int i = 0; i < n_grid_letters; i++)
+static void region_arenas_reserve(int count)    // one reset arena per region, the ones of the previous image are reused
+{
+    if(count > n_region_arenas)
     {
-        if(abs(grid_letters[i].y - prev_y) > 10)
+        region_arenas = realloc(region_arenas, count * sizeof(Arena*));
+
+        if(!region_arenas)
         {
-            row++;
-            col = 0;
+            errx(EXIT_FAILURE, "save_letters: out of memory");
         }
 
-        char filename[128];
+        for(int r = n_region_arenas; r < count; r++)
+            region_arenas[r] = arena_create(REGION_ARENA);
+
+        n_region_arenas = count;
+    }
+
+    for(int r = 0; r < count; r++)
+        arena_reset(region_arenas[r]);
+}
+
+static void keep_letter(Region* region, const RegionJob* job, const LetterBox* letter, int i, int j)
+{
+    int s = region -> saved++;
+
+    region -> boxes[s] = (SDL_Rect){ letter -> x, letter -> y, letter -> w, letter -> h };
+    region -> i[s] = i;
+    region -> j[s] = j;
+
+    if(region -> tiles)
+        glyph_normalize(letter -> view, letter -> cx - letter -> x, letter -> cy - letter -> y, region -> tiles + (size_t)s * GLYPH_PIXELS, region -> scratch);
+    else
+        save_letter(letter -> view, letter -> cx - letter -> x, letter -> cy - letter -> y, region -> kind, job -> name_len, job -> name, i, j, NULL);
+}
+
+static void segment_region(void* ctx, int index)
+{
+    RegionJob* job = ctx;
+    Region* region = &job -> regions[index];
+
+    BitImage* copy = crop_surface(job -> image, region -> rect);     // the letters are views into it
+    Arena* arena = region -> arena;
+    LetterBox* letters = extract_letters(arena, copy, &region -> count, REGION_PASS);
+
+    int n = region -> count;
+    float gap = median_height(arena, letters, n) / 2;
 
-        snprintf(filename, sizeof(filename), "datasets/%.*s/grid_letters/letter[%d,%d].bmp", (int)(dot - start), start, row, col);
+    region -> saved = 0;
+    region -> boxes = arena_alloc(arena, n * sizeof(SDL_Rect));
+    region -> i = arena_alloc(arena, n * sizeof(int));
+    region -> j = arena_alloc(arena, n * sizeof(int));
+    region -> tiles = (batch || corpus) ? arena_alloc(arena, (size_t)n * GLYPH_PIXELS) : NULL;
+    region -> scratch = region -> tiles ? arena_alloc(arena, GLYPH_SCRATCH(copy -> w) * sizeof(float)) : NULL;
 
-        if(SDL_SaveBMP(grid_letters[i].surface, filename) != 0) 
+    if(region -> kind == CORPUS_GRID)
+    {
+        Layout* cells = letters_layout(arena, letters, n, gap, gap);
+        layout_cells(cells);
+
+        for(int row = 0; row < cells -> rows; row++)
         {
-            printf("Failed to save %s: %s\n", filename, SDL_GetError());
+            for(int col = 0; col < cells -> cols; col++)
+            {
+                int i = layout_cell(cells, row, col);
+
+                if(i < 0) continue;     // missing letter, the next ones keep their column
+
+                keep_letter(region, job, &letters[i], row, col);
+            }
         }
 
-        col++;
+        layout_free(cells);
+    }
+    else
+    {
+        reading_order(arena, letters, n, gap);
 
-        prev_y = grid_letters[i].y;
+        for(int j = 0; j < n; j++)
+            keep_letter(region, job, &letters[j], region -> index, j);
     }
 
-    for(int i = 0; i < n_grid_letters; i++) 
+    free_letters(letters, n);
+    bit_free(copy);
+}
+
+void save_letters(BitImage* image, SDL_Surface* display, char* file, SegmentationSummary* summary) {
+
+    const char* dot = strrchr(file, '.');
+    const char* slash = strrchr(file, '/');
+    const char* name = (slash) ? slash + 1 : file;
+    int name_len = (int)(dot - name);
+
+    if(!page_arena)
+        page_arena = arena_create(PAGE_ARENA);
+
+    Arena* arena = page_arena;
+    arena_reset(arena);     // scratch of the previous image goes
+
+    if(!batch && !corpus)
+        writer_open();      // before the ruled grid and the region tasks share it
+
+    int n_grid_letters = 0;
+    GridLines* ruled = find_grid_lines(image);
+
+    if(ruled)     // the grid is read cell by cell then removed, the page pass only meets the words
     {
-        SDL_FreeSurface(grid_letters[i].surface);
+        n_grid_letters = save_ruled_grid(arena, image, ruled, name_len, name);
+
+        SDL_Rect rect = grid_lines_rect(ruled);
+        LetterBox grid = { .x = rect.x, .y = rect.y, .w = rect.w, .h = rect.h };
+
+        draw_rectangle_on_surface(display, grid, 255, 0, 0, 4, 10);
+        grid_lines_clear(image, ruled);
     }
 
-    free(grid_letters);
+    int n_letters;      // number of detected letters
 
-    words_count -= garbage_count;
+    LetterBox* letters = extract_letters(arena, image, &n_letters, PAGE_PASS);
+    reading_order(arena, letters, n_letters, median_height(arena, letters, n_letters) / 3);     // word list and grid rows may sit side by side
 
-    for(int i = 0; i < words_count; i++)
-    {
-        int n_word_letter;
+    LetterBox* boxes;
+    int box_count;
+    int max_box_w;
 
-        LetterBox* word_letters = extract_letters(words[i].surface, &n_word_letter, 0, 0, 255);
-        qsort(word_letters, n_word_letter, sizeof(LetterBox), compare_letters);
+    extract_boxes(arena, letters, n_letters, &boxes, &box_count, &max_box_w);
 
-        for(int j = 0; j < n_word_letter; j++)
-        {
-            char filename[128];
+    int words_count;
+    int garbage_count;
+    LetterBox* words;
 
-            printf("Word %d, letter %d: x=%d, y=%d, w=%d, h=%d\n", i + 1, j + 1, word_letters[j].x, word_letters[j].y, word_letters[j].w, word_letters[j].h);
+    int has_grid = 0;       // the grid is a region to segment, not when it was ruled
+    SDL_Rect grid_rect = { 0, 0, 0, 0 };
 
-            snprintf(filename, sizeof(filename), "datasets/%.*s/words_letters/word[%d,%d].bmp", (int)(dot - start), start, i, j);
+    if(ruled)
+    {
+        int text_h = text_height(arena, boxes, box_count);
+
+        words = arena_alloc(arena, box_count * sizeof(LetterBox));
+        words_count = 0;
+        garbage_count = 0;
 
-            if(SDL_SaveBMP(word_letters[j].surface, filename) != 0) 
+        for(int i = 0; i < box_count; i++)
+        {
+            if(header_garbage(boxes[i], text_h))
             {
-                printf("Failed to save %s: %s\n", filename, SDL_GetError());
+                garbage_count++;
+                continue;
             }
+
+            words[words_count++] = boxes[i];
+            draw_rectangle_on_surface(display, boxes[i], 0, 0, 255, 2, 5);
         }
 
-        for(int j = 0; j < n_word_letter; j++) 
+        printf("Detected %d garbages\n", garbage_count);
+        printf("Detected %d words\n", words_count);
+
+        grid_lines_free(ruled);
+    }
+    else
+    {
+        LetterBox grid = build_grid(arena, boxes, box_count, max_box_w, &words_count, &garbage_count);
+
+        draw_rectangle_on_surface(display, grid, 255, 0, 0, 4, 10);
+
+        printf("Detected %d garbages\n", garbage_count);
+        printf("Detected %d words\n", words_count - garbage_count);
+        words = arena_alloc(arena, (words_count - garbage_count) * sizeof(LetterBox));
+
+        int words_index = 0;
+
+        for(int i = 0; i < box_count; i++) 
         {
-            SDL_FreeSurface(word_letters[j].surface);
+            if(abs(max_box_w - boxes[i].w) > 20)
+            {
+                if(words_index >= garbage_count)
+                {
+                    words[words_index - garbage_count] = boxes[i];
+                    draw_rectangle_on_surface(display, boxes[i], 0, 0, 255, 2, 5);
+
+                    if(words_index == words_count)  break;
+                }
+
+                words_index++;
+            }
         }
 
-        free(word_letters);
+        words_count -= garbage_count;
+        has_grid = 1;
+        grid_rect = (SDL_Rect){ grid.x, grid.y, grid.w, grid.h };
     }
 
-    free(words);
+    int n_regions = has_grid + words_count;
+    Region* regions = arena_calloc(arena, n_regions, sizeof(Region));
 
-    for(int i = 0; i < box_count; i++) 
-    {
-        SDL_FreeSurface(boxes[i].surface);
-    }
+    region_arenas_reserve(n_regions);
+
+    if(has_grid)
+        regions[0] = (Region){ .arena = region_arenas[0], .rect = grid_rect, .kind = CORPUS_GRID };
+
+    for(int i = 0; i < words_count; i++)
+        regions[has_grid + i] = (Region){ .arena = region_arenas[has_grid + i], .rect = { words[i].x, words[i].y, words[i].w, words[i].h }, .kind = CORPUS_WORD, .index = i };
 
-    free(boxes);
+    RegionJob job = { image, regions, name_len, name };
+    parallel_for(n_regions, segment_region, &job);
 
-    for(int i = 0; i < n_letters; i++) 
+    int n_word_letters = 0;
+
+    for(int r = 0; r < n_regions; r++)      // serial order from here
     {
-        SDL_FreeSurface(letters[i].surface);
-    }
+        Region* region = &regions[r];
 
-    free(letters);
-}
+        if(region -> kind == CORPUS_GRID)
+        {
+            printf("Detected %d letters from the grid\n", region -> saved);
+
+            if(region -> saved < region -> count)      // the layout keeps the first letter of a cell
+                fprintf(stderr, "Warning: %d grid letters shared a cell with another one and were dropped\n", region -> count - region -> saved);
+
+            n_grid_letters = region -> saved;
+        }
+        else
+        {
+            for(int s = 0; s < region -> saved; s++)
+            {
+                SDL_Rect box = region -> boxes[s];
+                printf("Word %d, letter %d: x=%d, y=%d, w=%d, h=%d\n", region -> index + 1, s + 1, box.x, box.y, box.w, box.h);
+            }
 
+            n_word_letters += region -> saved;
+        }
 
+        for(int s = 0; region -> tiles && s < region -> saved; s++)
+        {
+            SDL_Rect box = region -> boxes[s];
+            store_tile(region -> tiles + (size_t)s * GLYPH_PIXELS, box.w, box.h, region -> kind, name_len, name, region -> i[s], region -> j[s]);
+        }
+    }
 
+    if(summary)
+    {
+        summary -> boxes = box_count;
+        summary -> words = words_count;
+        summary -> grid_letters = n_grid_letters;
+        summary -> word_letters = n_word_letters;
+        summary -> arena_peak = page_arena -> peak;
+
+        for(int r = 0; r < n_regions; r++)
+            summary -> arena_peak += region_arenas[r] -> peak;
+    }
 
+    free_letters(letters, n_letters);
+}
@@ -1,6 +1,32 @@
 #ifndef SEGMENTATION_H
 #define SEGMENTATION_H
 
-void save_letters(SDL_Surface* surface, SDL_Surface* display, char* file);
+#include "../image/image.h"
+#include "../corpus/corpus.h"
 
-#endif
\ No newline at end of file
+typedef struct {
+    int boxes;          // word and grid boxes found on the page
+    int words;          // words of the word list (garbage excluded)
+    int grid_letters;   // letters extracted from the grid
+    int word_letters;   // letters extracted from all the words
+    size_t arena_peak;  // scratch bytes of the page and region arenas at their peaks, added
+} SegmentationSummary;
+
+typedef struct {
+    int rows, cols;     // cells
+    int *y0, *y1;       // first and last row of every horizontal line, rows + 1 lines top to bottom
+    int *x0, *x1;       // first and last column of every vertical line, cols + 1 lines left to right
+} GridLines;            // printed lines of a ruled grid
+
+GridLines* find_grid_lines(const BitImage* image);
+void grid_lines_free(GridLines* grid);
+SDL_Rect grid_lines_rect(const GridLines* grid);
+int grid_cell_glyph(const BitImage* image, const GridLines* grid, int row, int col, SDL_Rect* glyph);
+void grid_lines_clear(BitImage* image, const GridLines* grid);
+
+void segmentation_set_corpus(CorpusWriter* writer);
+void segmentation_set_labels(const CorpusLabels* letters);
+void segmentation_set_batch(GlyphBatch* glyphs);
+void save_letters(BitImage* image, SDL_Surface* display, char* file, SegmentationSummary* summary);
+
+#endif
\ No newline at end of file
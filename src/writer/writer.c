@@ -0,0 +1,259 @@
+// libraries
+#include <stdlib.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+// headers
+#include "writer.h"
+
+// the dataset is written in the background : the segmentation copies every letter into a bounded
+// queue and goes on, io threads turn them into surfaces and save them. when the queue is full the
+// segmentation waits for a free slot, so memory stays bounded whatever the number of scans.
+// writing errors are not printed by the io threads, they are collected and reported by writer_wait.
+
+#define WRITER_ERRORS 16    // errors kept with their message, the others are only counted
+
+typedef struct {
+    BitImage* bits;         // owned copy of the letter
+    char* filename;
+} WriteTask;
+
+typedef struct {
+    SDL_mutex* lock;
+    SDL_cond* not_empty;    // a task was queued or the writer stops
+    SDL_cond* not_full;     // a slot was freed
+    SDL_cond* idle;         // every queued task was written
+
+    WriteTask tasks[WRITER_QUEUE];      // ring buffer
+    int head, count;
+    int busy;               // tasks taken by a thread and not written yet
+    int stopping;
+
+    int errors;
+    char* messages[WRITER_ERRORS];
+
+    int threads;
+    SDL_Thread* workers[WRITER_MAX_THREADS];
+} Writer;
+
+static int writer_threads = 2;     // 0 = every letter is written before save returns
+static Writer* writer = NULL;
+
+void writer_set_threads(int threads)
+{
+    if (threads < 0 || threads > WRITER_MAX_THREADS)
+    {
+        errx(EXIT_FAILURE, "writer: io threads must be between 0 and %d (got %d)", WRITER_MAX_THREADS, threads);
+    }
+
+    writer_stop();
+    writer_threads = threads;
+}
+
+static void record_error(Writer* w, const char* filename, const char* error)    // lock held
+{
+    if (w -> errors < WRITER_ERRORS)
+    {
+        size_t size = strlen(filename) + strlen(error) + 3;
+
+        w -> messages[w -> errors] = malloc(size);
+
+        if (w -> messages[w -> errors])
+            snprintf(w -> messages[w -> errors], size, "%s: %s", filename, error);
+    }
+
+    w -> errors++;
+}
+
+static void write_task(WriteTask* task, char* error, size_t size)     // error is left empty on success
+{
+    SDL_Surface* surface = bit_to_surface(task -> bits);
+
+    error[0] = '\0';
+
+    if (SDL_SaveBMP(surface, task -> filename) != 0)
+        snprintf(error, size, "%s", SDL_GetError());
+
+    SDL_FreeSurface(surface);
+    bit_free(task -> bits);
+}
+
+static int writer_worker(void* data)
+{
+    Writer* w = data;
+    char error[256];
+
+    SDL_LockMutex(w -> lock);
+
+    while (1)
+    {
+        while (w -> count == 0 && !w -> stopping)
+            SDL_CondWait(w -> not_empty, w -> lock);
+
+        if (w -> count == 0)    // stopping and nothing left
+            break;
+
+        WriteTask task = w -> tasks[w -> head];
+
+        w -> head = (w -> head + 1) % WRITER_QUEUE;
+        w -> count--;
+        w -> busy++;
+
+        SDL_CondSignal(w -> not_full);
+        SDL_UnlockMutex(w -> lock);
+
+        write_task(&task, error, sizeof(error));
+
+        SDL_LockMutex(w -> lock);
+
+        if (error[0])
+            record_error(w, task.filename, error);
+
+        free(task.filename);
+        w -> busy--;
+
+        if (w -> count == 0 && w -> busy == 0)
+            SDL_CondBroadcast(w -> idle);
+    }
+
+    SDL_UnlockMutex(w -> lock);
+
+    return 0;
+}
+
+static Writer* writer_start(void)
+{
+    Writer* w = calloc(1, sizeof(Writer));
+
+    if (!w)
+    {
+        errx(EXIT_FAILURE, "writer: out of memory");
+    }
+
+    w -> lock = SDL_CreateMutex();
+    w -> not_empty = SDL_CreateCond();
+    w -> not_full = SDL_CreateCond();
+    w -> idle = SDL_CreateCond();
+
+    if (!w -> lock || !w -> not_empty || !w -> not_full || !w -> idle)
+    {
+        errx(EXIT_FAILURE, "writer: %s", SDL_GetError());
+    }
+
+    w -> threads = writer_threads;
+
+    for (int t = 0; t < w -> threads; t++)
+    {
+        w -> workers[t] = SDL_CreateThread(writer_worker, "writer", w);
+
+        if (!w -> workers[t])
+        {
+            errx(EXIT_FAILURE, "writer: %s", SDL_GetError());
+        }
+    }
+
+    return w;
+}
+
+void writer_open(void)    // starts the io threads, before saving from several threads
+{
+    if (!writer)
+        writer = writer_start();
+}
+
+void writer_save_bits(BitView view, const char* filename)   // the letter is copied, the image it is read from can go right away
+{
+    writer_open();
+
+    WriteTask task = { bit_view_copy(view), strdup(filename) };
+
+    if (!task.filename)
+    {
+        errx(EXIT_FAILURE, "writer: out of memory");
+    }
+
+    SDL_LockMutex(writer -> lock);
+
+    if (writer -> threads == 0)     // synchronous
+    {
+        char error[256];
+
+        SDL_UnlockMutex(writer -> lock);
+        write_task(&task, error, sizeof(error));
+        SDL_LockMutex(writer -> lock);
+
+        if (error[0])
+            record_error(writer, task.filename, error);
+
+        free(task.filename);
+        SDL_UnlockMutex(writer -> lock);
+
+        return;
+    }
+
+    while (writer -> count == WRITER_QUEUE)
+        SDL_CondWait(writer -> not_full, writer -> lock);
+
+    writer -> tasks[(writer -> head + writer -> count) % WRITER_QUEUE] = task;
+    writer -> count++;
+
+    SDL_CondSignal(writer -> not_empty);
+    SDL_UnlockMutex(writer -> lock);
+}
+
+int writer_wait(void)     // waits for every queued letter, prints the errors since the last wait and returns their count
+{
+    if (!writer)
+        return 0;
+
+    SDL_LockMutex(writer -> lock);
+
+    while (writer -> count > 0 || writer -> busy > 0)
+        SDL_CondWait(writer -> idle, writer -> lock);
+
+    int errors = writer -> errors;
+
+    for (int i = 0; i < errors && i < WRITER_ERRORS; i++)
+    {
+        printf("Failed to save %s\n", writer -> messages[i] ? writer -> messages[i] : "a letter");
+        free(writer -> messages[i]);
+        writer -> messages[i] = NULL;
+    }
+
+    if (errors > WRITER_ERRORS)
+        printf("Failed to save %d more letters\n", errors - WRITER_ERRORS);
+
+    writer -> errors = 0;
+
+    SDL_UnlockMutex(writer -> lock);
+
+    return errors;
+}
+
+void writer_stop(void)    // writes what is left and ends the io threads
+{
+    if (!writer)
+        return;
+
+    writer_wait();
+
+    SDL_LockMutex(writer -> lock);
+    writer -> stopping = 1;
+    SDL_CondBroadcast(writer -> not_empty);
+    SDL_UnlockMutex(writer -> lock);
+
+    for (int t = 0; t < writer -> threads; t++)
+    {
+        SDL_WaitThread(writer -> workers[t], NULL);
+    }
+
+    SDL_DestroyMutex(writer -> lock);
+    SDL_DestroyCond(writer -> not_empty);
+    SDL_DestroyCond(writer -> not_full);
+    SDL_DestroyCond(writer -> idle);
+
+    free(writer);
+    writer = NULL;
+}
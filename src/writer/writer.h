@@ -0,0 +1,15 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "../image/image.h"
+
+#define WRITER_MAX_THREADS 16
+#define WRITER_QUEUE 256        // letters waiting to be written before the segmentation blocks
+
+void writer_set_threads(int threads);
+void writer_open(void);
+void writer_save_bits(BitView view, const char* filename);
+int writer_wait(void);
+void writer_stop(void);
+
+#endif